@@ -8,6 +8,7 @@ EXTRA_CFLAGS ?=
 EXTRA_LDFLAGS ?=
 
 DEBUG_BUILD ?=
+NO_PROBES ?=
 DESTDIR ?=
 prefix ?= /usr/local
 libdir ?= $(prefix)/lib
@@ -22,9 +23,14 @@ LDFLAGS := --warn-common --no-undefined --fatal-warnings \
 	   $(patsubst $(join -Wl,,)%,%,$(EXTRA_LDFLAGS))
 CFLAGS := -D_GNU_SOURCE -std=c99 -O2 -Wall -Werror -Werror=format=0 \
 	  $(addprefix -I, $(TOPDIR)/src/include $(nanomsg_includedir)) \
-	  -L$(nanomsg_libdir) -lnanomsg -lpthread -lrt \
+	  -L$(nanomsg_libdir) -lnanomsg -lpthread -lrt -ldl \
 	  $(EXTRA_CFLAGS) $(addprefix $(join -Wl,,),$(LDFLAGS))
 
 ifneq ($(DEBUG_BUILD),)
 	CFLAGS += -ggdb -DDEBUG
 endif
+
+# The USDT probes are built in if sys/sdt.h is available
+ifneq ($(NO_PROBES),)
+	CFLAGS += -DNNIO_NO_PROBES
+endif
@@ -31,13 +31,27 @@
 #include <time.h>
 #include <semaphore.h>
 #include <pthread.h>
+#include <sched.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include <sys/time.h>
 #include <sys/syscall.h>
 #include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <spawn.h>
+#include <dlfcn.h>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <limits.h>
 #include <linux/limits.h>
+#include <endian.h>
 
 #include <nanomsg/nn.h>
 #include <nanomsg/reqrep.h>
@@ -117,6 +131,12 @@ nnio_build_machine[];
 		}	\
 	} while (0)
 
+/* The default upper bound of waiting for the sent data to drain on exit,
+ * the same as the default linger timeout of nanomsg. See
+ * nnio_socket_drain() for the sockets it applies to.
+ */
+#define NNIO_DRAIN_TIMEOUT	1000
+
 typedef struct {
 	/* Input parameters */
 	void (*show_usage)(const char *prog);
@@ -130,16 +150,44 @@ typedef struct {
 	const char *socket_name;
 	const char **local_endpoint;
 	const char **remote_endpoint;
-	int exit_delay;		/* in millisecond */
+	int drain_timeout;	/* in millisecond */
 	bool quite;
 	const char *exec;
 	bool daemon;
 	const char *log_file;
+	unsigned int workers;
+	unsigned int concurrency;
+	bool stream;
+	unsigned int chunk_size;	/* in byte */
+	unsigned long max_messages;
+	bool chunked;
+	const char *file;
+	const char **topics;
+	unsigned int nr_topics;
+	int deadline;		/* in millisecond */
+	const char *back_url;
+	const char *agent;
+	const char *handler;
+	unsigned int threads;
+	bool pin_cpus;
+	bool timing;
+	const char *metrics;
 } nnio_options_t;
 
+typedef struct {
+	void *data;		/* allocated by nnio_alloc_data() */
+	unsigned int data_len;
+} nnio_msg_t;
+
+/* A growable buffer allocated by nnio_alloc_data() */
+typedef struct {
+	void *data;
+	unsigned long len;
+	unsigned long size;
+} nnio_buf_t;
+
 typedef struct {
 	sem_t *lock;
-	int shm_fd;
 } nnio_sync_t;
 
 nnio_sync_t *
@@ -154,6 +202,55 @@ nnio_sync_post(nnio_sync_t *sync);
 void
 nnio_sync_finish(nnio_sync_t *sync);
 
+/* Events for nnio_loop */
+#define NNIO_LOOP_IN		0x1
+#define NNIO_LOOP_OUT		0x2
+#define NNIO_LOOP_ERR		0x4
+
+typedef struct nnio_loop nnio_loop_t;
+typedef struct nnio_loop_source nnio_loop_source_t;
+
+/* Return a negative value to stop the loop */
+typedef int (*nnio_loop_handler_t)(nnio_loop_t *loop, nnio_loop_source_t *src,
+				   int fd, unsigned int events, void *priv);
+
+nnio_loop_t *
+nnio_loop_create(void);
+
+void
+nnio_loop_destroy(nnio_loop_t *loop);
+
+nnio_loop_source_t *
+nnio_loop_add_fd(nnio_loop_t *loop, int fd, unsigned int events,
+		 nnio_loop_handler_t handler, void *priv);
+
+nnio_loop_source_t *
+nnio_loop_add_socket(nnio_loop_t *loop, int sock, unsigned int events,
+		     nnio_loop_handler_t handler, void *priv);
+
+nnio_loop_source_t *
+nnio_loop_add_signal(nnio_loop_t *loop, int signo,
+		     nnio_loop_handler_t handler, void *priv);
+
+nnio_loop_source_t *
+nnio_loop_add_timer(nnio_loop_t *loop, int interval,
+		    nnio_loop_handler_t handler, void *priv);
+
+void
+nnio_loop_set_events(nnio_loop_source_t *src, unsigned int events);
+
+void
+nnio_loop_remove(nnio_loop_source_t *src);
+
+int
+nnio_loop_run_once(nnio_loop_t *loop, int timeout);
+
+int
+nnio_loop_run(nnio_loop_t *loop);
+
+void
+nnio_loop_stop(nnio_loop_t *loop, int rc);
+
 void
 nnio_show_banner(const char *prog_desc);
 
@@ -164,6 +261,10 @@ int
 nnio_socket_open(int protocol, int tx_timeout, int rx_timeout,
 		 const char *socket_name, int linger_timeout);
 
+int
+nnio_socket_open_raw(int protocol, int tx_timeout, int rx_timeout,
+		     const char *socket_name, int linger_timeout);
+
 void
 nnio_socket_close(int sock);
 
@@ -179,6 +280,54 @@ nnio_socket_set_linger_timeout(int sock, int timeout);
 int
 nnio_socket_set_name(int sock, const char *name);
 
+int
+nnio_socket_subscribe(int sock, const char *topic);
+
+int
+nnio_socket_set_deadline(int sock, int deadline);
+
+int
+nnio_socket_drain(int sock, int timeout);
+
+typedef enum {
+	NNIO_STAT_TX_MSGS,
+	NNIO_STAT_TX_BYTES,
+	NNIO_STAT_RX_MSGS,
+	NNIO_STAT_RX_BYTES,
+	NNIO_STAT_TX_TIMEOUTS,
+	NNIO_STAT_RX_TIMEOUTS,
+	NNIO_STAT_TX_EAGAIN,
+	NNIO_STAT_RX_EAGAIN,
+	NNIO_STAT_EINTR,
+	NNIO_NR_STATS
+} nnio_stat_t;
+
+void
+nnio_stats_open(int sock, int protocol, const char *name);
+
+void
+nnio_stats_close(int sock);
+
+void
+nnio_stats_add(int sock, nnio_stat_t stat, unsigned long n);
+
+void
+nnio_stats_show(FILE *fp);
+
+int
+nnio_stats_serve(const char *url);
+
+typedef struct {
+	int rx_sock;
+	int tx_sock;
+	bool *exiting;
+	unsigned long nr_msgs;
+	unsigned long nr_bytes;
+} nnio_forward_t;
+
+void
+nnio_forward(nnio_forward_t *fwd);
+
 int
 nnio_socket_tx(int sock, void *data, unsigned int data_len);
 
@@ -188,6 +337,29 @@ nnio_socket_rx(int sock, void **data, unsigned int *data_len);
 int
 nnio_socket_tx_iov(int sock, struct nn_iovec *iov, unsigned int nr_iov);
 
+int
+nnio_socket_tx_msg(int sock, void *msg, unsigned int msg_len);
+
+int
+nnio_socket_rx_batch(int sock, nnio_msg_t *msgs, unsigned int nr_msgs);
+
+int
+nnio_socket_tx_batch(int sock, nnio_msg_t *msgs, unsigned int nr_msgs);
+
+int
+nnio_socket_rx_raw(int sock, void **data, unsigned int *data_len,
+		   void **header, int flags);
+
+int
+nnio_socket_tx_raw(int sock, void *data, unsigned int data_len, void *header);
+
+int
+nnio_socket_tx_raw_stream(int sock, void *data, unsigned int data_len,
+			  void *header);
+
+void *
+nnio_socket_header(const void *sphdr, unsigned int sphdr_len);
+
 int
 nnio_endpoint_add_local(int sock, const char *endpoint);
 
@@ -200,6 +372,9 @@ nnio_endpoint_delete(int sock, int endpoint);
 int
 nnio_options_parse(int argc, char *argv[], nnio_options_t *options);
 
+const char *
+nnio_protocol_name(int protocol);
+
 bool
 nnio_util_verbose(void);
 
@@ -209,10 +384,198 @@ nnio_util_set_verbosity(bool verbose);
 void *
 nnio_alloc_data(unsigned long data_len);
 
+void *
+nnio_realloc_data(void *data, unsigned long data_len);
+
 void
 nnio_free_data(void *data);
 
+int
+nnio_buf_read(nnio_buf_t *buf, int fd);
+
+int
+nnio_buf_read_all(nnio_buf_t *buf, int fd);
+
+void *
+nnio_buf_detach(nnio_buf_t *buf, unsigned int *len);
+
+void
+nnio_buf_release(nnio_buf_t *buf);
+
+int
+nnio_write_iov(int fd, struct iovec *iov, int nr_iov);
+
+int
+nnio_thread_create(void *(*fn)(void *), void *arg);
+
+void *
+nnio_file_map(const char *path, unsigned long *len);
+
+void
+nnio_file_unmap(void *addr, unsigned long len);
+
+char **
+nnio_construct_argv(const char *argument);
+
+void
+nnio_free_argv(char **argv);
+
+char **
+nnio_spawn_prepare(const char *exec);
+
+pid_t
+nnio_spawn_process(const char *exec, int in_fd, int out_fd, int err_fd);
+
 int
 nnio_spawn(int sock, const char *exec, void *data, unsigned int data_len);
 
+int
+nnio_spawn_collect(const char *exec, void *data, unsigned int data_len,
+		   nnio_buf_t *out);
+
+pid_t
+nnio_spawn_async(const char *exec, int *in_fd, int *out_fd);
+
+uint64_t
+nnio_spawn_started(void);
+
+void
+nnio_spawn_exited(pid_t pid, int status, uint64_t started);
+
+int
+nnio_spawn_feed(int fd, void **data, unsigned int *data_len);
+
+int
+nnio_spawn_stream(int sock, const char *exec, void *data,
+		  unsigned int data_len, void *header);
+
+typedef enum {
+	NNIO_PHASE_TX,
+	NNIO_PHASE_ARGV,
+	NNIO_PHASE_SPAWN,
+	NNIO_PHASE_FEED,	/* From the start of child until stdin fed */
+	NNIO_PHASE_OUTPUT,	/* From the start of child until output EOF */
+	NNIO_PHASE_WAIT,
+	NNIO_PHASE_POOL,
+	NNIO_PHASE_HANDLER,
+	NNIO_PHASE_REQUEST,	/* From receiving a request until replied */
+	NNIO_NR_PHASES
+} nnio_phase_t;
+
+void
+nnio_timing_enable(bool enable);
+
+bool
+nnio_timing_enabled(void);
+
+void
+nnio_timing_exclude_thread(void);
+
+uint64_t
+nnio_timing_start(void);
+
+void
+nnio_timing_end(nnio_phase_t phase, uint64_t start);
+
+void
+nnio_timing_show(void);
+
+void
+nnio_timing_setup(bool enable);
+
+typedef struct nnio_pool nnio_pool_t;
+
+nnio_pool_t *
+nnio_pool_create(const char *exec, unsigned int nr_workers);
+
+void
+nnio_pool_destroy(nnio_pool_t *pool);
+
+int
+nnio_pool_exec(nnio_pool_t *pool, void *data, unsigned int data_len,
+	       void **out, unsigned int *out_len);
+
+typedef struct {
+	void *data;	/* Allocated by nn_allocmsg() */
+	size_t len;
+} nnio_reply_t;
+
+/*
+ * The request handler exported by a plugin. The request is only valid
+ * during the call. The handler allocates the reply with nn_allocmsg() and
+ * hands its ownership over to the caller, or leaves the reply untouched
+ * for an empty reply. The reply may be allocated larger than len, e.g,
+ * for the worst case, and is trimmed to len before being sent. Return a
+ * negative value for failure.
+ */
+typedef int (*nnio_handler_fn)(const void *req, size_t len,
+			       nnio_reply_t *reply);
+
+typedef struct nnio_handler nnio_handler_t;
+
+nnio_handler_t *
+nnio_handler_load(const char *spec);
+
+void
+nnio_handler_unload(nnio_handler_t *handler);
+
+int
+nnio_handler_call(nnio_handler_t *handler, const void *data,
+		  unsigned int data_len, void **out, unsigned int *out_len);
+
+/* The default chunk size for chunked transfer */
+#define NNIO_CHUNK_SIZE			(256 * 1024)
+
+/* In network byte order */
+typedef struct {
+	uint32_t magic;
+	uint32_t crc;		/* CRC32C of the payload */
+	uint64_t id;		/* The transfer id */
+	uint64_t offset;	/* The offset of the payload in transfer */
+	uint64_t total_len;	/* The length of transfer */
+} nnio_chunk_hdr_t;
+
+typedef struct {
+	int fd;			/* Write the chunks to fd if not -1 */
+	bool started;
+	uint64_t id;
+	uint64_t total_len;
+	uint64_t rx_len;
+	void *data;		/* The reassembly buffer if fd is -1 */
+} nnio_chunk_rx_t;
+
+uint32_t
+nnio_crc32c(uint32_t crc, const void *data, size_t len);
+
+int
+nnio_chunk_tx_data(int sock, const void *data, uint64_t len,
+		   unsigned int chunk_size);
+
+int
+nnio_chunk_tx_fd(int sock, int fd, uint64_t len, unsigned int chunk_size);
+
+void
+nnio_chunk_rx_init(nnio_chunk_rx_t *rx, int fd);
+
+int
+nnio_chunk_rx(int sock, nnio_chunk_rx_t *rx);
+
+void
+nnio_chunk_rx_release(nnio_chunk_rx_t *rx);
+
+int
+nnio_agent_call(const char *path, int protocol, const char *url, int in_fd,
+		int out_fd);
+
+int
+nnio_agent_call_file(const char *path, int protocol, const char *url,
+		     const char *file);
+
+int
+nnio_agent_receive(int conn, int *protocol, char **url, int *in_fd,
+		   int *out_fd);
+
+void
+nnio_agent_reply(int conn, int result);
+
 #endif	/* NNIO_H */
@@ -0,0 +1,262 @@
+/*
+ * Client agent
+ *
+ * Copyright (c) 2016, Wind River Systems, Inc.
+ * All rights reserved.
+ *
+ * See "LICENSE" for license terms.
+ *
+ * Author:
+ *	  Lans Zhang <jia.zhang@windriver.com>
+ */
+
+#include <nnio.h>
+
+/*
+ * A short-lived client hands a call over to nanoagent through a unix
+ * socket instead of setting up its own nanomsg socket. The call consists
+ * of a nnio_agent_call_t followed by the url, and carries the input and
+ * output fds of the client with SCM_RIGHTS, so the payload is read and the
+ * reply is written by the agent directly. The agent replies the result of
+ * the call as an int.
+ */
+
+typedef struct {
+	int32_t protocol;
+	uint32_t url_len;
+} nnio_agent_call_t;
+
+static int
+send_call(int conn, int protocol, const char *url, int in_fd, int out_fd)
+{
+	nnio_agent_call_t call = {
+		.protocol = protocol,
+		.url_len = strlen(url),
+	};
+	struct iovec iov[] = {
+		{
+			.iov_base = &call,
+			.iov_len = sizeof(call),
+		},
+		{
+			.iov_base = (void *)url,
+			.iov_len = call.url_len,
+		},
+	};
+	union {
+		char buf[CMSG_SPACE(2 * sizeof(int))];
+		struct cmsghdr align;
+	} control;
+	struct msghdr msg = {
+		.msg_iov = iov,
+		.msg_iovlen = 2,
+		.msg_control = control.buf,
+		.msg_controllen = sizeof(control.buf),
+	};
+
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(2 * sizeof(int));
+
+	int fds[2] = { in_fd, out_fd };
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+	ssize_t sz;
+	do {
+		sz = sendmsg(conn, &msg, MSG_NOSIGNAL);
+	} while (sz < 0 && errno == EINTR);
+
+	return sz == (ssize_t)(sizeof(call) + call.url_len) ? 0 : -1;
+}
+
+/*
+ * Run a call through the agent listening on path. Return the result of the
+ * call, or -1 if the agent is not available.
+ */
+int
+nnio_agent_call(const char *path, int protocol, const char *url, int in_fd,
+		int out_fd)
+{
+	struct sockaddr_un addr = {
+		.sun_family = AF_UNIX,
+	};
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		err("Agent path %s too long\n", path);
+		return -1;
+	}
+
+	strcpy(addr.sun_path, path);
+
+	int conn = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	nnio_error_assert(conn >= 0, "Unable to create unix socket");
+
+	int rc = -1;
+	if (connect(conn, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		err("Unable to connect agent %s (%s)\n", path,
+		    strerror(errno));
+		goto out;
+	}
+
+	if (send_call(conn, protocol, url, in_fd, out_fd) < 0) {
+		err("Failed to send the call to agent\n");
+		goto out;
+	}
+
+	int32_t result;
+	ssize_t sz;
+	do {
+		sz = recv(conn, &result, sizeof(result), MSG_WAITALL);
+	} while (sz < 0 && errno == EINTR);
+
+	if (sz != sizeof(result)) {
+		err("Failed to receive the result from agent\n");
+		goto out;
+	}
+
+	rc = result;
+
+out:
+	close(conn);
+
+	return rc;
+}
+
+/*
+ * Run a call with the payload read from file, or stdin if file is NULL, and
+ * the reply written to stdout.
+ */
+int
+nnio_agent_call_file(const char *path, int protocol, const char *url,
+		     const char *file)
+{
+	int fd = STDIN_FILENO;
+
+	if (file) {
+		fd = open(file, O_RDONLY | O_CLOEXEC);
+		if (fd < 0) {
+			err("Unable to open %s\n", file);
+			return -1;
+		}
+	}
+
+	int rc = nnio_agent_call(path, protocol, url, fd, STDOUT_FILENO);
+
+	if (file)
+		close(fd);
+
+	return rc;
+}
+
+/* Close whatever fds came along with a call which is refused */
+static void
+close_rights(struct msghdr *msg)
+{
+	for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg;
+	     cmsg = CMSG_NXTHDR(msg, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET ||
+		    cmsg->cmsg_type != SCM_RIGHTS)
+			continue;
+
+		int nr_fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		for (int i = 0; i < nr_fds; ++i) {
+			int fd;
+
+			memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int),
+			       sizeof(fd));
+			close(fd);
+		}
+	}
+}
+
+/*
+ * Receive a call on the connection accepted by the agent. The url must be
+ * freed by the caller, and so must the fds be closed.
+ */
+int
+nnio_agent_receive(int conn, int *protocol, char **url, int *in_fd,
+		   int *out_fd)
+{
+	nnio_agent_call_t call;
+	union {
+		char buf[CMSG_SPACE(2 * sizeof(int))];
+		struct cmsghdr align;
+	} control;
+	struct iovec iov = {
+		.iov_base = &call,
+		.iov_len = sizeof(call),
+	};
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = control.buf,
+		.msg_controllen = sizeof(control.buf),
+	};
+
+	ssize_t sz;
+	do {
+		sz = recvmsg(conn, &msg, MSG_WAITALL | MSG_CMSG_CLOEXEC);
+	} while (sz < 0 && errno == EINTR);
+
+	if (sz <= 0) {
+		err("Failed to receive the call from client\n");
+		return -1;
+	}
+
+	/* The fds passed are installed even if the control data is
+	 * truncated, so they must not be leaked.
+	 */
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	if (!cmsg || (msg.msg_flags & MSG_CTRUNC) ||
+	    cmsg->cmsg_level != SOL_SOCKET ||
+	    cmsg->cmsg_type != SCM_RIGHTS ||
+	    cmsg->cmsg_len != CMSG_LEN(2 * sizeof(int))) {
+		err("No fds received from client\n");
+		close_rights(&msg);
+		return -1;
+	}
+
+	int fds[2];
+	memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+	if (sz != sizeof(call) || call.url_len >= PATH_MAX) {
+		err("Invalid call received from client\n");
+		goto err_call;
+	}
+
+	*url = malloc(call.url_len + 1);
+	nnio_error_assert(*url, "Failed to allocate url");
+
+	do {
+		sz = recv(conn, *url, call.url_len, MSG_WAITALL);
+	} while (sz < 0 && errno == EINTR);
+
+	if (sz != call.url_len) {
+		err("Failed to receive the url from client\n");
+		free(*url);
+		goto err_call;
+	}
+
+	(*url)[call.url_len] = 0;
+	*protocol = call.protocol;
+	*in_fd = fds[0];
+	*out_fd = fds[1];
+
+	return 0;
+
+err_call:
+	close(fds[0]);
+	close(fds[1]);
+
+	return -1;
+}
+
+void
+nnio_agent_reply(int conn, int result)
+{
+	int32_t rc = result;
+
+	if (send(conn, &rc, sizeof(rc), MSG_NOSIGNAL) != sizeof(rc))
+		err("Failed to send the result to client\n");
+}
@@ -0,0 +1,375 @@
+/*
+ * Chunked transfer
+ *
+ * Copyright (c) 2016, Wind River Systems, Inc.
+ * All rights reserved.
+ *
+ * See "LICENSE" for license terms.
+ *
+ * Author:
+ *	  Lans Zhang <jia.zhang@windriver.com>
+ */
+
+#include <nnio.h>
+#ifdef __x86_64__
+#include <nmmintrin.h>
+#endif
+
+/*
+ * A payload larger than NN_RCVMAXSIZE of the receiver is split into chunks,
+ * each of which is sent as a message prefixed by nnio_chunk_hdr_t in network
+ * byte order. The header identifies the transfer, the location of the chunk
+ * in the payload and the total length, so the receiver is able to
+ * preallocate the reassembly buffer from the first chunk. The payload of
+ * each chunk is protected by CRC32C.
+ *
+ * An empty payload is still sent as a chunk with no payload. The chunks
+ * of a transfer are sent and received in order.
+ */
+
+#define NNIO_CHUNK_MAGIC		0x4e4e434b	/* "NNCK" */
+
+#define CRC32C_POLY			0x82f63b78
+
+static uint32_t crc32c_table[256];
+static uint32_t (*crc32c_update)(uint32_t crc, const void *data, size_t len);
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+static uint32_t
+crc32c_sw(uint32_t crc, const void *data, size_t len)
+{
+	const uint8_t *p = data;
+
+	while (len--)
+		crc = crc32c_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+
+	return crc;
+}
+
+#ifdef __x86_64__
+__attribute__((target("sse4.2")))
+static uint32_t
+crc32c_sse42(uint32_t crc, const void *data, size_t len)
+{
+	const uint8_t *p = data;
+
+	while (len && ((uintptr_t)p & 7)) {
+		crc = _mm_crc32_u8(crc, *p++);
+		--len;
+	}
+
+	while (len >= 8) {
+		crc = (uint32_t)_mm_crc32_u64(crc, *(const uint64_t *)p);
+		p += 8;
+		len -= 8;
+	}
+
+	while (len--)
+		crc = _mm_crc32_u8(crc, *p++);
+
+	return crc;
+}
+#endif
+
+static void
+crc32c_init(void)
+{
+	for (uint32_t i = 0; i < 256; ++i) {
+		uint32_t crc = i;
+
+		for (int j = 0; j < 8; ++j)
+			crc = (crc >> 1) ^ (crc & 1 ? CRC32C_POLY : 0);
+
+		crc32c_table[i] = crc;
+	}
+
+	crc32c_update = crc32c_sw;
+
+#ifdef __x86_64__
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse4.2"))
+		crc32c_update = crc32c_sse42;
+#endif
+}
+
+/*
+ * Calculate CRC32C (Castagnoli) with the crc32 instruction if available.
+ * Pass 0 as crc for the first block.
+ */
+uint32_t
+nnio_crc32c(uint32_t crc, const void *data, size_t len)
+{
+	pthread_once(&crc32c_once, crc32c_init);
+
+	return ~crc32c_update(~crc, data, len);
+}
+
+static uint64_t
+new_transfer_id(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+
+	return ((uint64_t)getpid() << 32) ^ (ts.tv_sec * 1000000000ULL +
+					       ts.tv_nsec);
+}
+
+/*
+ * Allocate a chunk message able to carry len-byte payload. The payload is
+ * located at chunk_payload() of the returned message.
+ */
+static void *
+alloc_chunk(unsigned int len)
+{
+	void *msg = nnio_alloc_data(sizeof(nnio_chunk_hdr_t) + len);
+	nnio_error_assert(msg, "Failed to allocate %d-byte chunk", len);
+
+	return msg;
+}
+
+static void *
+chunk_payload(void *msg)
+{
+	return msg + sizeof(nnio_chunk_hdr_t);
+}
+
+/* Fill the header and send the chunk in zero-copy */
+static int
+send_chunk(int sock, void *msg, unsigned int len, uint64_t id,
+	   uint64_t offset, uint64_t total_len)
+{
+	nnio_chunk_hdr_t *hdr = msg;
+
+	hdr->magic = htonl(NNIO_CHUNK_MAGIC);
+	hdr->crc = htonl(nnio_crc32c(0, chunk_payload(msg), len));
+	hdr->id = htobe64(id);
+	hdr->offset = htobe64(offset);
+	hdr->total_len = htobe64(total_len);
+
+	dbg("preparing to send %d-byte chunk at %ld/%ld ...\n", len,
+	    (long)offset, (long)total_len);
+
+	int rc = nnio_socket_tx_msg(sock, msg, sizeof(*hdr) + len);
+	if (rc < 0) {
+		err("Failed to send %d-byte chunk to socket\n", len);
+		nnio_free_data(msg);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Send a payload in memory as a chunked transfer */
+int
+nnio_chunk_tx_data(int sock, const void *data, uint64_t len,
+		   unsigned int chunk_size)
+{
+	uint64_t id = new_transfer_id();
+	uint64_t offset = 0;
+
+	if (!chunk_size)
+		chunk_size = NNIO_CHUNK_SIZE;
+
+	do {
+		unsigned int sz = len - offset < chunk_size ?
+				  len - offset : chunk_size;
+
+		void *msg = alloc_chunk(sz);
+		memcpy(chunk_payload(msg), data + offset, sz);
+
+		if (send_chunk(sock, msg, sz, id, offset, len) < 0)
+			return -1;
+
+		offset += sz;
+	} while (offset < len);
+
+	return 0;
+}
+
+/*
+ * Send len-byte read from fd as a chunked transfer. The data is read into
+ * the chunk messages directly, so only one chunk is buffered at a time on
+ * top of the socket send buffer.
+ */
+int
+nnio_chunk_tx_fd(int sock, int fd, uint64_t len, unsigned int chunk_size)
+{
+	uint64_t id = new_transfer_id();
+	uint64_t offset = 0;
+
+	if (!chunk_size)
+		chunk_size = NNIO_CHUNK_SIZE;
+
+	do {
+		unsigned int sz = len - offset < chunk_size ?
+				  len - offset : chunk_size;
+		void *msg = alloc_chunk(sz);
+		unsigned int off = 0;
+
+		while (off < sz) {
+			ssize_t rc = read(fd, chunk_payload(msg) + off,
+					  sz - off);
+			if (rc <= 0) {
+				if (rc < 0 && errno == EINTR)
+					continue;
+
+				err("Failed to read %d-byte chunk at %ld\n",
+				    sz, (long)offset);
+				nnio_free_data(msg);
+				return -1;
+			}
+
+			off += rc;
+		}
+
+		if (send_chunk(sock, msg, sz, id, offset, len) < 0)
+			return -1;
+
+		offset += sz;
+	} while (offset < len);
+
+	return 0;
+}
+
+/*
+ * Prepare to receive a chunked transfer. If fd is not -1, each chunk is
+ * written to fd at its offset as soon as it arrives, and no reassembly
+ * buffer is allocated.
+ */
+void
+nnio_chunk_rx_init(nnio_chunk_rx_t *rx, int fd)
+{
+	memset(rx, 0, sizeof(*rx));
+	rx->fd = fd;
+}
+
+void
+nnio_chunk_rx_release(nnio_chunk_rx_t *rx)
+{
+	free(rx->data);
+	rx->data = NULL;
+}
+
+static int
+write_chunk(nnio_chunk_rx_t *rx, const void *data, unsigned int len,
+	    uint64_t offset)
+{
+	while (len) {
+		ssize_t sz = pwrite(rx->fd, data, len, offset);
+
+		/* A pipe is written in order as the chunks arrive */
+		if (sz < 0 && errno == ESPIPE)
+			sz = write(rx->fd, data, len);
+
+		if (sz < 0) {
+			if (errno == EINTR)
+				continue;
+
+			err("Failed to write %d-byte chunk at %ld\n", len,
+			    (long)offset);
+			return -1;
+		}
+
+		data += sz;
+		len -= sz;
+		offset += sz;
+	}
+
+	return 0;
+}
+
+/* Return 0 if the transfer is complete, 1 if more chunks are expected */
+static int
+rx_chunk(nnio_chunk_rx_t *rx, void *msg, unsigned int msg_len)
+{
+	nnio_chunk_hdr_t *hdr = msg;
+
+	if (msg_len < sizeof(*hdr) || ntohl(hdr->magic) != NNIO_CHUNK_MAGIC) {
+		err("Invalid chunk received\n");
+		return -1;
+	}
+
+	unsigned int len = msg_len - sizeof(*hdr);
+	uint64_t id = be64toh(hdr->id);
+	uint64_t offset = be64toh(hdr->offset);
+	uint64_t total_len = be64toh(hdr->total_len);
+
+	if (!rx->started) {
+		if (rx->fd == -1 && total_len) {
+			rx->data = malloc(total_len);
+			if (!rx->data) {
+				err("Failed to allocate %ld-byte reassembly "
+				    "buffer\n", (long)total_len);
+				return -1;
+			}
+		}
+
+		rx->id = id;
+		rx->total_len = total_len;
+		rx->started = true;
+	} else if (id != rx->id) {
+		warn("Dropping a chunk of other transfer\n");
+		return 1;
+	}
+
+	if (offset > total_len || len > total_len - offset ||
+	    total_len != rx->total_len) {
+		err("Chunk at %ld is out of range\n", (long)offset);
+		return -1;
+	}
+
+	/* The chunks are sent in order, so the one before rx_len is resent
+	 * and the one beyond it means the chunks in between are lost.
+	 */
+	if (offset < rx->rx_len) {
+		warn("Dropping the duplicated chunk at %ld\n", (long)offset);
+		return 1;
+	}
+
+	if (offset > rx->rx_len) {
+		err("Missing the chunks at %ld-%ld\n", (long)rx->rx_len,
+		    (long)offset);
+		return -1;
+	}
+
+	if (nnio_crc32c(0, chunk_payload(msg), len) != ntohl(hdr->crc)) {
+		err("CRC mismatch on chunk at %ld\n", (long)offset);
+		return -1;
+	}
+
+	dbg("reading %d-byte chunk at %ld/%ld ...\n", len, (long)offset,
+	    (long)total_len);
+
+	if (rx->fd != -1) {
+		if (write_chunk(rx, chunk_payload(msg), len, offset) < 0)
+			return -1;
+	} else
+		memcpy(rx->data + offset, chunk_payload(msg), len);
+
+	rx->rx_len += len;
+
+	return rx->rx_len < rx->total_len;
+}
+
+/*
+ * Receive the chunks until the transfer is complete. The payload is in
+ * rx->data if no fd is specified, and must be released by
+ * nnio_chunk_rx_release().
+ */
+int
+nnio_chunk_rx(int sock, nnio_chunk_rx_t *rx)
+{
+	while (1) {
+		void *msg;
+		unsigned int msg_len;
+
+		if (nnio_socket_rx(sock, &msg, &msg_len) < 0)
+			return -1;
+
+		int rc = rx_chunk(rx, msg, msg_len);
+		nnio_free_data(msg);
+		if (rc <= 0)
+			return rc;
+	}
+}
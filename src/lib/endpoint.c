@@ -11,6 +11,7 @@
  */
 
 #include <nnio.h>
+#include "probe.h"
 
 int
 nnio_endpoint_add_local(int sock, const char *endpoint)
@@ -19,6 +20,7 @@ nnio_endpoint_add_local(int sock, const char *endpoint)
 		return -1;
 
 	int rc = nn_bind(sock, endpoint);
+	nnio_probe3(endpoint_bind, sock, endpoint, rc < 0 ? nn_errno() : 0);
 	if (rc >= 0) {
 		/* nn_connect() may leak EAGAIN sometimes */
 		errno = 0;
@@ -37,6 +39,8 @@ nnio_endpoint_add_remote(int sock, const char *endpoint)
 		return -1;
 
 	int rc = nn_connect(sock, endpoint);
+	nnio_probe3(endpoint_connect, sock, endpoint,
+		    rc < 0 ? nn_errno() : 0);
 	if (rc >= 0) {
 		/* nn_connect() may leak ENOENT sometimes */
 		errno = 0;
@@ -61,11 +65,15 @@ nnio_endpoint_delete(int sock, int endpoint)
 
 	do {
 		int rc = nn_shutdown(sock, endpoint);
-		if (!rc)
+		if (!rc) {
+			nnio_probe3(endpoint_shutdown, sock, endpoint, 0);
 			return;
+		}
 
 		err = nn_errno();
 	} while (err == EINTR);
 
+	nnio_probe3(endpoint_shutdown, sock, endpoint, err);
+
 	nnio_error_assert(0, "Unable to close socket");
 }
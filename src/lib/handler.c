@@ -0,0 +1,110 @@
+/*
+ * In-process request handler
+ *
+ * Copyright (c) 2016, Wind River Systems, Inc.
+ * All rights reserved.
+ *
+ * See "LICENSE" for license terms.
+ *
+ * Author:
+ *	  Lans Zhang <jia.zhang@windriver.com>
+ */
+
+#include <nnio.h>
+
+/*
+ * A handler is a nnio_handler_fn exported by a shared object, specified as
+ * "<path>:<symbol>". The shared object is loaded once and the handler is
+ * called for each request in the process of server, so no process is
+ * created on the request path.
+ */
+
+/* The symbol looked up if not specified */
+#define NNIO_HANDLER_SYMBOL	"nnio_handler"
+
+struct nnio_handler {
+	void *dl;
+	nnio_handler_fn fn;
+};
+
+nnio_handler_t *
+nnio_handler_load(const char *spec)
+{
+	char *path = strdup(spec);
+	nnio_error_assert(path, "Failed to allocate handler path");
+
+	const char *symbol = NNIO_HANDLER_SYMBOL;
+	char *sep = strrchr(path, ':');
+	if (sep) {
+		*sep = 0;
+		symbol = sep + 1;
+	}
+
+	nnio_handler_t *handler = calloc(1, sizeof(*handler));
+	nnio_error_assert(handler, "Failed to allocate handler");
+
+	handler->dl = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+	if (!handler->dl)
+		die("Unable to load handler %s: %s\n", path, dlerror());
+
+	/* Clear the error state before telling a NULL symbol from failure */
+	dlerror();
+
+	handler->fn = (nnio_handler_fn)dlsym(handler->dl, symbol);
+	const char *e = dlerror();
+	if (e || !handler->fn)
+		die("Unable to find handler %s in %s: %s\n", symbol, path,
+		    e ? e : "NULL symbol");
+
+	dbg("handler %s loaded from %s\n", symbol, path);
+
+	free(path);
+
+	return handler;
+}
+
+void
+nnio_handler_unload(nnio_handler_t *handler)
+{
+	dlclose(handler->dl);
+	free(handler);
+}
+
+/*
+ * Run a request through the handler. The request is still owned by the
+ * caller. The reply is allocated by the handler with nn_allocmsg(), and
+ * NULL is returned in out for an empty reply. Return -1 if the handler
+ * failed, in which case the reply is discarded.
+ */
+int
+nnio_handler_call(nnio_handler_t *handler, const void *data,
+		  unsigned int data_len, void **out, unsigned int *out_len)
+{
+	nnio_reply_t reply = {
+		.data = NULL,
+		.len = 0,
+	};
+
+	int rc = handler->fn(data, data_len, &reply);
+	if (rc < 0)
+		err("Handler failed with %d\n", rc);
+
+	if ((rc < 0 || !reply.len) && reply.data) {
+		nnio_free_data(reply.data);
+		reply.data = NULL;
+	}
+
+	/* nanomsg sends the whole buffer on zero-copy, and the size it was
+	 * allocated with is unknown here, so trim it to the reply length. A
+	 * shrink is done in place.
+	 */
+	if (reply.data) {
+		reply.data = nnio_realloc_data(reply.data, reply.len);
+		nnio_error_assert(reply.data, "Failed to trim reply");
+	}
+
+	*out = reply.data;
+	*out_len = reply.data ? reply.len : 0;
+
+	return rc < 0 ? -1 : 0;
+}
@@ -0,0 +1,433 @@
+/*
+ * Event loop
+ *
+ * Copyright (c) 2016, Wind River Systems, Inc.
+ * All rights reserved.
+ *
+ * See "LICENSE" for license terms.
+ *
+ * Author:
+ *	  Lans Zhang <jia.zhang@windriver.com>
+ */
+
+#include <nnio.h>
+
+#define NNIO_LOOP_MAX_EVENTS		64
+
+enum {
+	NNIO_LOOP_SOURCE_FD,
+	NNIO_LOOP_SOURCE_SOCKET,
+	NNIO_LOOP_SOURCE_SIGNAL,
+	NNIO_LOOP_SOURCE_TIMER,
+};
+
+/* A file descriptor registered in epoll on behalf of a source. A nanomsg
+ * socket needs two of them, NN_RCVFD for rx and NN_SNDFD for tx.
+ */
+struct nnio_loop_watch {
+	nnio_loop_source_t *src;
+	int fd;
+	unsigned int events;
+	bool armed;
+};
+
+struct nnio_loop_source {
+	nnio_loop_t *loop;
+	int type;
+	/* The fd, nanomsg socket or signal number reported to handler */
+	int id;
+	unsigned int events;
+	struct nnio_loop_watch watch[2];
+	nnio_loop_handler_t handler;
+	void *priv;
+	bool dead;
+	nnio_loop_source_t *next;
+};
+
+struct nnio_loop {
+	int epfd;
+	bool stop;
+	int rc;
+	nnio_loop_source_t *sources;
+};
+
+static uint32_t
+to_epoll_events(unsigned int events)
+{
+	uint32_t ep_events = 0;
+
+	if (events & NNIO_LOOP_IN)
+		ep_events |= EPOLLIN;
+
+	if (events & NNIO_LOOP_OUT)
+		ep_events |= EPOLLOUT;
+
+	return ep_events;
+}
+
+static unsigned int
+from_epoll_events(uint32_t ep_events)
+{
+	unsigned int events = 0;
+
+	if (ep_events & EPOLLIN)
+		events |= NNIO_LOOP_IN;
+
+	if (ep_events & EPOLLOUT)
+		events |= NNIO_LOOP_OUT;
+
+	if (ep_events & (EPOLLERR | EPOLLHUP))
+		events |= NNIO_LOOP_ERR;
+
+	return events;
+}
+
+static void
+arm_watch(nnio_loop_t *loop, struct nnio_loop_watch *watch, bool arm)
+{
+	struct epoll_event ev;
+	int op;
+
+	if (watch->fd < 0)
+		return;
+
+	if (arm) {
+		op = watch->armed ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+		ev.events = to_epoll_events(watch->events);
+		ev.data.ptr = watch;
+	} else {
+		if (!watch->armed)
+			return;
+
+		op = EPOLL_CTL_DEL;
+	}
+
+	int rc = epoll_ctl(loop->epfd, op, watch->fd, &ev);
+	nnio_error_assert(!rc, "Failed to update epoll for fd %d", watch->fd);
+
+	watch->armed = arm;
+}
+
+static nnio_loop_source_t *
+add_source(nnio_loop_t *loop, int type, int id, nnio_loop_handler_t handler,
+	   void *priv)
+{
+	nnio_loop_source_t *src = calloc(1, sizeof(*src));
+	nnio_error_assert(src, "Failed to allocate loop source");
+
+	src->loop = loop;
+	src->type = type;
+	src->id = id;
+	src->handler = handler;
+	src->priv = priv;
+	src->watch[0].src = src;
+	src->watch[0].fd = -1;
+	src->watch[1].src = src;
+	src->watch[1].fd = -1;
+
+	src->next = loop->sources;
+	loop->sources = src;
+
+	return src;
+}
+
+nnio_loop_t *
+nnio_loop_create(void)
+{
+	nnio_loop_t *loop = calloc(1, sizeof(*loop));
+	nnio_error_assert(loop, "Failed to allocate loop");
+
+	loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+	nnio_error_assert(loop->epfd >= 0, "Failed to create epoll");
+
+	return loop;
+}
+
+/* Reclaim the sources removed while dispatching the events */
+static void
+reap_sources(nnio_loop_t *loop)
+{
+	nnio_loop_source_t **pp = &loop->sources;
+
+	while (*pp) {
+		nnio_loop_source_t *src = *pp;
+
+		if (src->dead) {
+			*pp = src->next;
+			free(src);
+		} else
+			pp = &src->next;
+	}
+}
+
+void
+nnio_loop_destroy(nnio_loop_t *loop)
+{
+	for (nnio_loop_source_t *src = loop->sources; src; src = src->next)
+		nnio_loop_remove(src);
+
+	reap_sources(loop);
+	close(loop->epfd);
+	free(loop);
+}
+
+/*
+ * Watch an ordinary fd, e.g, a pipe to child process. The handler is called
+ * with the fd and the ready events.
+ */
+nnio_loop_source_t *
+nnio_loop_add_fd(nnio_loop_t *loop, int fd, unsigned int events,
+		 nnio_loop_handler_t handler, void *priv)
+{
+	nnio_loop_source_t *src = add_source(loop, NNIO_LOOP_SOURCE_FD, fd,
+					     handler, priv);
+
+	src->watch[0].fd = fd;
+	nnio_loop_set_events(src, events);
+
+	return src;
+}
+
+/*
+ * Watch a nanomsg socket through NN_RCVFD and NN_SNDFD. The handler is
+ * called with the socket and NNIO_LOOP_IN if a message can be received or
+ * NNIO_LOOP_OUT if a message can be sent. Note that the readiness is level
+ * triggered so the handler is supposed to use NN_DONTWAIT.
+ */
+nnio_loop_source_t *
+nnio_loop_add_socket(nnio_loop_t *loop, int sock, unsigned int events,
+		     nnio_loop_handler_t handler, void *priv)
+{
+	nnio_loop_source_t *src = add_source(loop, NNIO_LOOP_SOURCE_SOCKET,
+					     sock, handler, priv);
+	size_t sz = sizeof(int);
+	int rc;
+
+	/* Not all protocols support both directions */
+	rc = nn_getsockopt(sock, NN_SOL_SOCKET, NN_RCVFD, &src->watch[0].fd,
+			   &sz);
+	if (rc < 0) {
+		nnio_error_assert(nn_errno() == ENOPROTOOPT,
+				  "Failed to get NN_RCVFD");
+		src->watch[0].fd = -1;
+	}
+
+	sz = sizeof(int);
+	rc = nn_getsockopt(sock, NN_SOL_SOCKET, NN_SNDFD, &src->watch[1].fd,
+			   &sz);
+	if (rc < 0) {
+		nnio_error_assert(nn_errno() == ENOPROTOOPT,
+				  "Failed to get NN_SNDFD");
+		src->watch[1].fd = -1;
+	}
+
+	nnio_loop_set_events(src, events);
+
+	return src;
+}
+
+/*
+ * Watch a signal through signalfd. The signal is blocked so it is only
+ * delivered through the loop. The handler is called with the signal number
+ * each time the signal arrives.
+ */
+nnio_loop_source_t *
+nnio_loop_add_signal(nnio_loop_t *loop, int signo,
+		     nnio_loop_handler_t handler, void *priv)
+{
+	sigset_t mask;
+
+	sigemptyset(&mask);
+	sigaddset(&mask, signo);
+
+	int rc = sigprocmask(SIG_BLOCK, &mask, NULL);
+	nnio_error_assert(!rc, "Failed to block signal %d", signo);
+
+	int fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+	nnio_error_assert(fd >= 0, "Failed to create signalfd for %d", signo);
+
+	nnio_loop_source_t *src = add_source(loop, NNIO_LOOP_SOURCE_SIGNAL,
+					     signo, handler, priv);
+
+	src->watch[0].fd = fd;
+	nnio_loop_set_events(src, NNIO_LOOP_IN);
+
+	return src;
+}
+
+/*
+ * Run the handler periodically through timerfd, in millisecond. The handler
+ * is called with the timerfd.
+ */
+nnio_loop_source_t *
+nnio_loop_add_timer(nnio_loop_t *loop, int interval,
+		    nnio_loop_handler_t handler, void *priv)
+{
+	int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	nnio_error_assert(fd >= 0, "Failed to create timerfd");
+
+	struct itimerspec its = {
+		.it_interval = {
+			.tv_sec = interval / 1000,
+			.tv_nsec = (interval % 1000) * 1000000,
+		},
+	};
+	its.it_value = its.it_interval;
+
+	int rc = timerfd_settime(fd, 0, &its, NULL);
+	nnio_error_assert(!rc, "Failed to arm timerfd");
+
+	nnio_loop_source_t *src = add_source(loop, NNIO_LOOP_SOURCE_TIMER,
+					     fd, handler, priv);
+
+	src->watch[0].fd = fd;
+	nnio_loop_set_events(src, NNIO_LOOP_IN);
+
+	return src;
+}
+
+/*
+ * Change the events watched for a source. Passing 0 pauses the source
+ * without removing it.
+ */
+void
+nnio_loop_set_events(nnio_loop_source_t *src, unsigned int events)
+{
+	nnio_loop_t *loop = src->loop;
+
+	src->events = events;
+
+	if (src->type == NNIO_LOOP_SOURCE_SOCKET) {
+		/* Both fds are signaled as readable */
+		src->watch[0].events = NNIO_LOOP_IN;
+		arm_watch(loop, &src->watch[0], events & NNIO_LOOP_IN);
+
+		src->watch[1].events = NNIO_LOOP_IN;
+		arm_watch(loop, &src->watch[1], events & NNIO_LOOP_OUT);
+	} else {
+		src->watch[0].events = events;
+		arm_watch(loop, &src->watch[0], !!events);
+	}
+}
+
+/*
+ * Stop watching a source. It is safe to call it from a handler, including
+ * the handler of the source itself.
+ */
+void
+nnio_loop_remove(nnio_loop_source_t *src)
+{
+	if (src->dead)
+		return;
+
+	nnio_loop_set_events(src, 0);
+
+	if (src->type == NNIO_LOOP_SOURCE_SIGNAL) {
+		sigset_t mask;
+
+		sigemptyset(&mask);
+		sigaddset(&mask, src->id);
+		sigprocmask(SIG_UNBLOCK, &mask, NULL);
+
+		close(src->watch[0].fd);
+	} else if (src->type == NNIO_LOOP_SOURCE_TIMER)
+		close(src->watch[0].fd);
+
+	src->dead = true;
+}
+
+static int
+dispatch(struct nnio_loop_watch *watch, uint32_t ep_events)
+{
+	nnio_loop_source_t *src = watch->src;
+	unsigned int events = from_epoll_events(ep_events);
+
+	switch (src->type) {
+	case NNIO_LOOP_SOURCE_SOCKET:
+		if (watch == &src->watch[1])
+			events = NNIO_LOOP_OUT;
+		else
+			events = NNIO_LOOP_IN;
+		break;
+	case NNIO_LOOP_SOURCE_SIGNAL:
+		while (1) {
+			struct signalfd_siginfo si;
+
+			ssize_t sz = read(watch->fd, &si, sizeof(si));
+			if (sz != sizeof(si))
+				return 0;
+
+			int rc = src->handler(src->loop, src, src->id,
+					      NNIO_LOOP_IN, src->priv);
+			if (rc < 0 || src->dead)
+				return rc;
+		}
+	case NNIO_LOOP_SOURCE_TIMER: {
+		uint64_t expirations;
+
+		if (read(watch->fd, &expirations, sizeof(expirations)) < 0)
+			return 0;
+		break;
+	}
+	default:
+		break;
+	}
+
+	return src->handler(src->loop, src, src->id, events, src->priv);
+}
+
+/*
+ * Wait for the events up to timeout in millisecond and dispatch them.
+ * Return the number of events dispatched.
+ */
+int
+nnio_loop_run_once(nnio_loop_t *loop, int timeout)
+{
+	struct epoll_event evs[NNIO_LOOP_MAX_EVENTS];
+
+	int nr_evs = epoll_wait(loop->epfd, evs, NNIO_LOOP_MAX_EVENTS,
+				timeout);
+	if (nr_evs < 0) {
+		nnio_error_assert(errno == EINTR, "Failed to wait for events");
+		return 0;
+	}
+
+	for (int i = 0; i < nr_evs && !loop->stop; ++i) {
+		struct nnio_loop_watch *watch = evs[i].data.ptr;
+
+		/* Removed by a handler in this round */
+		if (watch->src->dead || !watch->armed)
+			continue;
+
+		int rc = dispatch(watch, evs[i].events);
+		if (rc < 0)
+			nnio_loop_stop(loop, rc);
+	}
+
+	reap_sources(loop);
+
+	return nr_evs;
+}
+
+/*
+ * Dispatch the events until nnio_loop_stop() is called or a handler returns
+ * a negative value. Return the value passed to nnio_loop_stop().
+ */
+int
+nnio_loop_run(nnio_loop_t *loop)
+{
+	loop->stop = false;
+	loop->rc = 0;
+
+	while (!loop->stop)
+		nnio_loop_run_once(loop, -1);
+
+	return loop->rc;
+}
+
+void
+nnio_loop_stop(nnio_loop_t *loop, int rc)
+{
+	loop->stop = true;
+	loop->rc = rc;
+}
@@ -11,6 +11,10 @@
  */
 
 #include <nnio.h>
+#include "probe.h"
+
+/* The capacity of the pipes connected to a child */
+#define NNIO_SPAWN_PIPE_SIZE		(1024 * 1024)
 
 void
 nnio_show_banner(const char *prog_desc)
@@ -35,16 +39,31 @@ nnio_alloc_data(unsigned long data_len)
 	return nn_allocmsg(data_len, 0);
 }
 
+/* Resize a buffer allocated by nnio_alloc_data(). This is mainly used to
+ * trim a buffer to the exact payload length before passing it on to
+ * nnio_socket_tx_msg(), because nanomsg takes the message length from the
+ * size of the buffer.
+ */
+void *
+nnio_realloc_data(void *data, unsigned long data_len)
+{
+	return nn_reallocmsg(data, data_len);
+}
+
 void
 nnio_free_data(void *data)
 {
 	nn_freemsg(data);
 }
 
-/* Construct argv[] for execvp() */
-static char **
-construct_argv(const char *argument)
+/* Construct argv[] for execvp(). Free it with nnio_free_argv(). */
+char **
+nnio_construct_argv(const char *argument)
 {
+	/* Make argv[0] point to the beginning of args */
+	while (*argument && isspace(*argument))
+		++argument;
+
 	char *args = malloc(strlen(argument) + 1);
 	nnio_error_assert(args, "Failed to allocate args");
 
@@ -83,9 +102,20 @@ construct_argv(const char *argument)
 			*curr_arg++ = 0;
 	}
 
+	if (!argc)
+		free(args);
+
 	return argv;
 }
 
+void
+nnio_free_argv(char **argv)
+{
+	/* All arguments are stored in the buffer of argv[0] */
+	free(argv[0]);
+	free(argv);
+}
+
 nnio_sync_t *
 nnio_sync_init(const char *name)
 {
@@ -94,25 +124,18 @@ nnio_sync_init(const char *name)
 	sync = malloc(sizeof(*sync));
 	nnio_error_assert(sync, "Error on allocate nnio_sync");
 
-	const char *shm_name = name;
-	int shm_fd = shm_open(shm_name, O_CREAT | O_RDWR, S_IRUSR | S_IWUSR);
-	nnio_error_assert(shm_fd >= 0, "Error on creating shared memory object");
-
-	shm_unlink(shm_name);
-
-	/* Used to sync up with child process for feeding its stdin */
-	int rc = ftruncate(shm_fd, sizeof(sem_t));
-	nnio_error_assert(!rc, "Error on truncating");
-
+	/* An anonymous shared mapping is inherited by the child process, so
+	 * a named shared memory object is unnecessary. This also avoids the
+	 * name collision between the concurrent users.
+	 */
 	sem_t *lock = mmap(NULL, sizeof(*lock), PROT_READ | PROT_WRITE,
-			   MAP_SHARED, shm_fd, 0);
-	nnio_error_assert(lock != MAP_FAILED, "Error on mmap");
+			   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	nnio_error_assert(lock != MAP_FAILED, "Error on mmap for %s", name);
 
-	rc = sem_init(lock, 1, 0);
+	int rc = sem_init(lock, 1, 0);
 	nnio_error_assert(!rc, "Error on initializing semaphore");
 
 	sync->lock = lock;
-	sync->shm_fd = shm_fd;
 
 	return sync;
 }
@@ -133,156 +156,358 @@ void
 nnio_sync_finish(nnio_sync_t *sync)
 {
 	sem_destroy(sync->lock);
-	munmap(sync->lock, sizeof(*sync));
-	close(sync->shm_fd);
+	munmap(sync->lock, sizeof(*sync->lock));
+	free(sync);
 }
 
-int
-nnio_spawn(int sock, const char *exec, void *data, unsigned int data_len)
-{
-	int input_fds[2], output_fds[2];
-	int rc;
+/* The argv[] parsed for each command line */
+struct spawn_argv {
+	const char *exec;
+	char **argv;
+	struct spawn_argv *next;
+};
+
+static struct spawn_argv *spawn_argvs;
+static pthread_mutex_t spawn_argvs_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t sigpipe_once = PTHREAD_ONCE_INIT;
 
+static void
+ignore_sigpipe(void)
+{
 	nnio_error_assert(signal(SIGPIPE, SIG_IGN) != SIG_ERR,
 			  "Unable to capture SIGPIPE");
+}
 
-	/* Create two pipelines for reading and writing */
-	rc = pipe(input_fds);
-	nnio_error_assert(rc >= 0, "Error on creating the pipe for input");
+/*
+ * Parse the command line into argv[] once and cache it for the subsequent
+ * spawns. Calling it at startup keeps the parsing out of the request path.
+ *
+ * SIGPIPE is ignored for good in the caller from the first call, so that
+ * feeding a child exited early fails with EPIPE instead of killing the
+ * caller. The disposition is process-wide, so it is never restored, which
+ * would race with the spawns in other threads.
+ */
+char **
+nnio_spawn_prepare(const char *exec)
+{
+	struct spawn_argv *sa;
 
-	rc = pipe(output_fds);
-	nnio_error_assert(rc >= 0, "Error on creating the pipe for output");
+	pthread_once(&sigpipe_once, ignore_sigpipe);
 
-	const char *sync_name = "__spawn__";
-	nnio_sync_t *sync = nnio_sync_init(sync_name);
-	nnio_error_assert(sync, "Error on creating the sync object %s", sync_name);
+	pthread_mutex_lock(&spawn_argvs_lock);
 
-	pid_t child = fork();
-	nnio_error_assert((int)child >= 0, "Error on forking subprocess");
+	for (sa = spawn_argvs; sa; sa = sa->next) {
+		if (!strcmp(sa->exec, exec))
+			break;
+	}
 
-	if (!child) {
-		int fd = -1;
+	if (!sa) {
+		sa = malloc(sizeof(*sa));
+		nnio_error_assert(sa, "Failed to allocate argv cache");
 
-		/* For debugging */
-		if (nnio_util_verbose())
-			fd = dup(STDOUT_FILENO);
+		sa->exec = strdup(exec);
+		nnio_error_assert(sa->exec, "Failed to allocate argv cache");
 
-		close(input_fds[1]);
-		close(output_fds[0]);
+		sa->argv = nnio_construct_argv(exec);
+		nnio_error_assert(sa->argv[0], "No executable in \"%s\"", exec);
 
-		/* Bind the stdin to the input endpoint of input pipe */
-		dup2(input_fds[0], STDIN_FILENO);
-		/* Bind the stdout/stderr to the output endpoint of output
-		 * pipe */
-		dup2(output_fds[1], STDOUT_FILENO);
-		dup2(output_fds[1], STDERR_FILENO);
+		sa->next = spawn_argvs;
+		spawn_argvs = sa;
+	}
 
-		close(input_fds[0]);
-		close(output_fds[1]);
+	pthread_mutex_unlock(&spawn_argvs_lock);
 
-		char **argv = construct_argv(exec);
-		nnio_error_assert(argv, "Error on creating argv[]");
+	return sa->argv;
+}
 
-		/* Unlocked by the parent after feeding stdin */
-		nnio_sync_wait(sync);
+/*
+ * Start a child process with its stdin, stdout and stderr redirected to the
+ * given fds. Pass -1 to inherit the one of the caller. The fds not to be
+ * inherited by the child are supposed to have O_CLOEXEC.
+ *
+ * posix_spawn() is used instead of fork() so the cost doesn't grow with
+ * the memory size of the caller. The child always starts with the default
+ * signal mask and SIGPIPE disposition. Return -1 with errno set if the child
+ * fails to execute.
+ */
+pid_t
+nnio_spawn_process(const char *exec, int in_fd, int out_fd, int err_fd)
+{
+	uint64_t start = nnio_timing_start();
 
-		if (nnio_util_verbose()) {
-			FILE *fp = fdopen(fd, "w");
-			nnio_error_assert(fp, "Failed to open fd");
-			fprintf(fp, "child starting ...\n");
-			fflush(fp);
-			close(fd);
-		}
+	nnio_probe1(spawn_fork, exec);
+
+	char **argv = nnio_spawn_prepare(exec);
+	posix_spawn_file_actions_t actions;
+	posix_spawnattr_t attr;
+	sigset_t mask;
+	pid_t child;
+
+	nnio_timing_end(NNIO_PHASE_ARGV, start);
+	start = nnio_timing_start();
+
+	uint64_t spawned = nnio_probe_enabled(spawn_exec) ?
+			   nnio_probe_clock() : 0;
+
+	posix_spawn_file_actions_init(&actions);
+
+	if (in_fd >= 0)
+		posix_spawn_file_actions_adddup2(&actions, in_fd, STDIN_FILENO);
 
-		execvp(argv[0], argv);
+	if (out_fd >= 0)
+		posix_spawn_file_actions_adddup2(&actions, out_fd,
+						 STDOUT_FILENO);
 
-		/* Should not return */
-		nnio_error_assert(0, "Error on executing subprocess");
+	if (err_fd >= 0)
+		posix_spawn_file_actions_adddup2(&actions, err_fd,
+						 STDERR_FILENO);
+
+	posix_spawnattr_init(&attr);
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK |
+				 POSIX_SPAWN_SETSIGDEF);
+
+	sigemptyset(&mask);
+	posix_spawnattr_setsigmask(&attr, &mask);
+
+	sigaddset(&mask, SIGPIPE);
+	posix_spawnattr_setsigdefault(&attr, &mask);
+
+	int rc = posix_spawnp(&child, argv[0], &actions, &attr, argv,
+			      environ);
+
+	posix_spawnattr_destroy(&attr);
+	posix_spawn_file_actions_destroy(&actions);
+
+	/* posix_spawnp() returns once the child is executed */
+	nnio_probe3(spawn_exec, rc ? -1 : child, rc,
+		    spawned ? nnio_probe_clock() - spawned : 0);
+
+	if (rc) {
+		errno = rc;
+		return -1;
 	}
 
+	nnio_timing_end(NNIO_PHASE_SPAWN, start);
+
+	dbg("child %d started\n", child);
+
+	return child;
+}
+
+/*
+ * Start a child process without waiting for it. The stdin and stdout/stderr
+ * of the child are connected to the nonblocking pipes returned in in_fd and
+ * out_fd, and the caller is responsible for feeding, draining and reaping
+ * the child, e.g, with nnio_loop. Return -1 if the child fails to execute.
+ */
+pid_t
+nnio_spawn_async(const char *exec, int *in_fd, int *out_fd)
+{
+	int input_fds[2], output_fds[2];
+	int rc;
+
+	/* Don't leak the pipes to other children running concurrently */
+	rc = pipe2(input_fds, O_CLOEXEC);
+	nnio_error_assert(rc >= 0, "Error on creating the pipe for input");
+
+	rc = pipe2(output_fds, O_CLOEXEC);
+	nnio_error_assert(rc >= 0, "Error on creating the pipe for output");
+
+	/* A larger pipe takes more data per wakeup. It is fine to fail,
+	 * e.g, beyond /proc/sys/fs/pipe-max-size.
+	 */
+	fcntl(input_fds[1], F_SETPIPE_SZ, NNIO_SPAWN_PIPE_SIZE);
+	fcntl(output_fds[0], F_SETPIPE_SZ, NNIO_SPAWN_PIPE_SIZE);
+
+	pid_t child = nnio_spawn_process(exec, input_fds[0], output_fds[1],
+					 output_fds[1]);
+
 	close(input_fds[0]);
 	close(output_fds[1]);
 
-	ssize_t sz;
-	while ((int)data_len > 0) {
-		sz = write(input_fds[1], data, data_len);
-		if (sz < 0 && errno == EPIPE)
-		    break;
+	if (child < 0) {
+		err("Failed to execute %s: %s\n", exec, strerror(errno));
+		close(input_fds[1]);
+		close(output_fds[0]);
+		return -1;
+	}
 
-		nnio_error_assert(sz >= 0, "Failed to write");
+	rc = fcntl(input_fds[1], F_SETFL, O_NONBLOCK);
+	nnio_error_assert(!rc, "Error on F_SETFL for %d", input_fds[1]);
 
-		if (sz == data_len)
-		    break;
+	rc = fcntl(output_fds[0], F_SETFL, O_NONBLOCK);
+	nnio_error_assert(!rc, "Error on F_SETFL for %d", output_fds[0]);
 
-		data += sz;
-		data_len -= sz;
+	*in_fd = input_fds[1];
+	*out_fd = output_fds[0];
+
+	return child;
+}
+
+/*
+ * Feed the nonblocking stdin of a child with vmsplice() so the data is
+ * mapped into the pipe rather than copied. The pages are referenced by the
+ * pipe until the child consumes them, so the data must not be modified or
+ * freed until then, e.g, until the child exits.
+ *
+ * Return 1 if there is data left to feed once the pipe is writable again,
+ * or 0 if all data is fed or the child closed its stdin.
+ */
+int
+nnio_spawn_feed(int fd, void **data, unsigned int *data_len)
+{
+	while (*data_len) {
+		struct iovec iov = {
+			.iov_base = *data,
+			.iov_len = *data_len,
+		};
+
+		ssize_t sz = vmsplice(fd, &iov, 1, SPLICE_F_NONBLOCK);
+		if (sz < 0) {
+			if (errno == EAGAIN)
+				return 1;
+
+			if (errno == EINTR)
+				continue;
+
+			/* The child doesn't care about its stdin */
+			nnio_error_assert(errno == EPIPE, "Failed to feed stdin");
+			break;
+		}
+
+		*data += sz;
+		*data_len -= sz;
 	}
 
-	close(input_fds[1]);
-	signal(SIGPIPE, SIG_DFL);
+	return 0;
+}
 
-	dbg("parent syncing up ...\n");
-	nnio_sync_post(sync);
+/* Drain the readable output pipe. Return 0 at EOF, or -1 if it fails. */
+typedef int (*spawn_drain_t)(int fd, void *priv);
 
-	wait(NULL);
-	dbg("child exited\n");
+/*
+ * Run a child process to completion. The stdin of child is fed while its
+ * output is drained, so neither side blocks on a full pipe no matter how
+ * much data flows. Return -1 if the child fails to execute or its output
+ * fails to be read.
+ */
+static int
+run_child(const char *exec, void *data, unsigned int data_len,
+	  spawn_drain_t drain, void *priv)
+{
+	int in_fd, out_fd;
+	int rc;
 
-	rc = fcntl(output_fds[0], F_GETFL);
-	nnio_error_assert(rc >= 0, "Error on F_GETFD for %d", output_fds[0]);
+	/* SIGPIPE is ignored by nnio_spawn_prepare() */
+	uint64_t spawned = nnio_spawn_started();
+	pid_t child = nnio_spawn_async(exec, &in_fd, &out_fd);
+	if (child < 0)
+		return -1;
 
-	rc = fcntl(output_fds[0], F_SETFL, rc | O_NONBLOCK);
-	nnio_error_assert(!rc, "Error on F_SETFD for %d", output_fds[0]);
+	uint64_t start = nnio_timing_start();
+
+	/* The input pipe is the last one so it can be dropped once fed */
+	struct pollfd fds[2] = {
+		{ .fd = out_fd, .events = POLLIN, },
+		{ .fd = in_fd, .events = POLLOUT, },
+	};
+	int nr_fds = 2;
+
+	if (!data_len) {
+		close(in_fd);
+		nr_fds = 1;
+	}
 
-	struct nn_iovec *iov = NULL;
-	unsigned int nr_iov = 0;
-	unsigned long total_tx_len = 0;
 	while (1) {
-		dbg("preparing to read the output pipe ...\n");
+		if (poll(fds, nr_fds, -1) < 0) {
+			nnio_error_assert(errno == EINTR, "Failed to poll");
+			continue;
+		}
 
-		void *buf = nnio_alloc_data(PIPE_BUF);
-		nnio_error_assert(buf, "Failed to allocate buffer");
+		if (nr_fds == 2 && fds[1].revents &&
+		    !nnio_spawn_feed(in_fd, &data, &data_len)) {
+			dbg("stdin fed\n");
+			nnio_timing_end(NNIO_PHASE_FEED, start);
+			close(in_fd);
+			nr_fds = 1;
+		}
 
-		ssize_t buf_len = read(output_fds[0], buf, PIPE_BUF);
-		if (buf_len < 0) {
-			if (errno == EAGAIN) {
-				dbg("no data available on nonblocking output "
-				    "pipe\n");
+		if (fds[0].revents) {
+			rc = drain(out_fd, priv);
+			if (rc <= 0) {
+				dbg("output pipe EOF\n");
+				nnio_timing_end(NNIO_PHASE_OUTPUT, start);
 				break;
 			}
-
-			nnio_error_assert(buf_len >= 0, "Failed to read");
 		}
+	}
 
-		if (!buf_len) {
-			dbg("output pipe EOF\n");
-			break;
-		}
+	if (nr_fds == 2)
+		close(in_fd);
+	close(out_fd);
 
-		iov = realloc(iov, (++nr_iov) * sizeof(*iov));
-		nnio_error_assert(iov, "Failed to allocate iov");
+	/* Don't reap other children of the caller */
+	start = nnio_timing_start();
 
-		iov[nr_iov - 1].iov_base = buf;
-		iov[nr_iov - 1].iov_len = buf_len;
+	int status;
+	waitpid(child, &status, 0);
 
-		total_tx_len += buf_len;
-	}
+	nnio_timing_end(NNIO_PHASE_WAIT, start);
+	nnio_spawn_exited(child, status, spawned);
+	dbg("child exited\n");
+
+	return rc < 0 ? -1 : 0;
+}
+
+static int
+collect_output(int fd, void *priv)
+{
+	dbg("preparing to read the output pipe ...\n");
+
+	return nnio_buf_read(priv, fd);
+}
 
-	close(output_fds[0]);
+/*
+ * Run a child process and append its output to out, e.g, following a
+ * prefix the caller put in. Return -1 if the child fails to execute or its
+ * output fails to be read, in which case out holds what was read before.
+ */
+int
+nnio_spawn_collect(const char *exec, void *data, unsigned int data_len,
+		   nnio_buf_t *out)
+{
+	return run_child(exec, data, data_len, collect_output, out);
+}
+
+/*
+ * Run a child process and reply its output as a single message. Return -1
+ * if the child fails to execute, its output fails to be read or the reply
+ * fails to be sent.
+ */
+int
+nnio_spawn(int sock, const char *exec, void *data, unsigned int data_len)
+{
+	nnio_buf_t out = { NULL, };
+	int rc;
 
-	nnio_sync_finish(sync);
+	/* An empty or partial output is replied if the child failed to execute
+	 * or its output failed to be read.
+	 */
+	int spawn_rc = nnio_spawn_collect(exec, data, data_len, &out);
 
-	if (total_tx_len) {
-		dbg("preparing to send %ld-byte to socket ...\n", total_tx_len);
+	/* The output is accumulated in one message to be handed over to
+	 * nanomsg directly.
+	 */
+	unsigned int out_len;
+	void *msg = nnio_buf_detach(&out, &out_len);
+	if (msg) {
+		dbg("preparing to send %d-byte to socket ...\n", out_len);
 
-		rc = nnio_socket_tx_iov(sock, iov, nr_iov);
+		rc = nnio_socket_tx_msg(sock, msg, out_len);
 		if (rc < 0) {
-			err("Failed to send %ld-byte data to socket\n",
-			    total_tx_len);
+			err("Failed to send %d-byte data to socket\n", out_len);
+			nnio_free_data(msg);
 		}
-
-		for (unsigned int i = 0; i < nr_iov; ++i)
-			nnio_free_data(iov[i].iov_base);
-		free(iov);
 	} else {
 		/* For nanomsg socket, a nil tx can even unblock the rx side */
 		dbg("preparing to send a nil to socket ...\n");
@@ -292,5 +517,87 @@ nnio_spawn(int sock, const char *exec, void *data, unsigned int data_len)
 			err("Failed to send nil data to socket\n");
 	}
 
+	return rc < 0 || spawn_rc < 0 ? -1 : 0;
+}
+
+
+static int
+send_stream(int sock, void *data, unsigned int data_len, void *header)
+{
+	if (header)
+		return nnio_socket_tx_raw_stream(sock, data, data_len, header);
+
+	if (data)
+		return nnio_socket_tx_msg(sock, data, data_len);
+
+	return nnio_socket_tx(sock, "", 0);
+}
+
+typedef struct {
+	int sock;
+	void *header;
+	int rc;
+} spawn_stream_t;
+
+static int
+forward_output(int fd, void *priv)
+{
+	spawn_stream_t *stream = priv;
+	nnio_buf_t out = { NULL, };
+
+	/* Whatever is available so far makes up a chunk, up to the read limit.
+	 * If the read fails, the data read before is still sent.
+	 */
+	int rc = nnio_buf_read(&out, fd);
+
+	unsigned int buf_len;
+	void *buf = nnio_buf_detach(&out, &buf_len);
+	if (!buf)
+		return rc;
+
+	dbg("preparing to send %d-byte chunk to socket ...\n", buf_len);
+
+	/* Keep draining the child even if the peer is gone */
+	if (stream->rc < 0 ||
+	    send_stream(stream->sock, buf, buf_len, stream->header) < 0) {
+		if (!stream->rc)
+			err("Failed to send %d-byte chunk to socket\n", buf_len);
+		nnio_free_data(buf);
+		stream->rc = -1;
+	}
+
+	return rc;
+}
+
+/*
+ * Run a child process and forward its output to the socket as a stream, i.e,
+ * each chunk read from the output pipe is sent as soon as it arrives, and
+ * an empty message follows the last chunk to mark the end of stream.
+ *
+ * For a raw socket, header is the protocol header of the request which the
+ * stream replies to. It is not consumed. Pass NULL for other sockets.
+ */
+int
+nnio_spawn_stream(int sock, const char *exec, void *data,
+		  unsigned int data_len, void *header)
+{
+	spawn_stream_t stream = {
+		.sock = sock,
+		.header = header,
+	};
+
+	/* An empty stream is replied if the child failed to execute */
+	run_child(exec, data, data_len, forward_output, &stream);
+	if (stream.rc < 0)
+		return -1;
+
+	dbg("preparing to send the end of stream to socket ...\n");
+
+	int rc = send_stream(sock, NULL, 0, header);
+	if (rc < 0) {
+		err("Failed to send the end of stream to socket\n");
+		return -1;
+	}
+
 	return 0;
 }
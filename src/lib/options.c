@@ -18,26 +18,26 @@ nnio_show_banner(const char *prog_desc);
 extern void
 nnio_show_version(void);
 
+static struct {
+	const char *name;
+	int protocol;
+} protocol_names[] = {
+	{ "push", NN_PUSH },
+	{ "pull", NN_PULL },
+	{ "pub", NN_PUB },
+	{ "sub", NN_SUB },
+	{ "req", NN_REQ },
+	{ "rep", NN_REP },
+	{ "bus", NN_BUS },
+	{ "pair", NN_PAIR },
+	{ "surveyor", NN_SURVEYOR },
+	{ "respondent", NN_RESPONDENT },
+	{ NULL, 0 },
+};
+
 static int
 check_protocol(const char *name)
 {
-	struct {
-		const char *name;
-		int protocol;
-	} protocol_names[] = {
-		{ "push", NN_PUSH },
-		{ "pull", NN_PULL },
-		{ "pub", NN_PUB },
-		{ "sub", NN_SUB },
-		{ "req", NN_REQ },
-		{ "rep", NN_REP },
-		{ "bus", NN_BUS },
-		{ "pair", NN_PAIR },
-		{ "surveyor", NN_SURVEYOR },
-		{ "respondent", NN_RESPONDENT },
-		{ NULL, 0 },
-	};
-
 	for (int i = 0; protocol_names[i].name; ++i) {
 		if (!strcmp(protocol_names[i].name, name))
 			return protocol_names[i].protocol;
@@ -48,10 +48,21 @@ check_protocol(const char *name)
 	return -1;
 }
 
+const char *
+nnio_protocol_name(int protocol)
+{
+	for (int i = 0; protocol_names[i].name; ++i) {
+		if (protocol_names[i].protocol == protocol)
+			return protocol_names[i].name;
+	}
+
+	return "unknown";
+}
+
 int
 nnio_options_parse(int argc, char *argv[], nnio_options_t *options)
 {
-	char opts[] = "-hVvqp:t:r:n:RLl:e:E:g:d";
+	char opts[] = "-hVvqp:t:r:n:RLl:e:E:g:dw:c:sk:m:Cf:S:D:b:a:H:T:PiM:";
 	struct option long_opts[] = {
 		{ "help", no_argument, NULL, 'h' },
 		{ "version", no_argument, NULL, 'V' },
@@ -64,10 +75,27 @@ nnio_options_parse(int argc, char *argv[], nnio_options_t *options)
 		{ "socket-name", required_argument, NULL, 'n' },
 		{ "remote-endpoint", no_argument, NULL, 'R' },
 		{ "local-endpoint", no_argument, NULL, 'L' },
-		{ "exit-delay", no_argument, NULL, 'e' },
+		{ "drain-timeout", required_argument, NULL, 'e' },
+		{ "exit-delay", required_argument, NULL, 'e' },
 		{ "exec", required_argument, NULL, 'E' },
 		{ "log-file", required_argument, NULL, 'g' },
 		{ "daemon", no_argument, NULL, 'd' },
+		{ "workers", required_argument, NULL, 'w' },
+		{ "concurrency", required_argument, NULL, 'c' },
+		{ "stream", no_argument, NULL, 's' },
+		{ "chunk-size", required_argument, NULL, 'k' },
+		{ "max-messages", required_argument, NULL, 'm' },
+		{ "chunked", no_argument, NULL, 'C' },
+		{ "file", required_argument, NULL, 'f' },
+		{ "subscribe", required_argument, NULL, 'S' },
+		{ "deadline", required_argument, NULL, 'D' },
+		{ "back-end", required_argument, NULL, 'b' },
+		{ "agent", required_argument, NULL, 'a' },
+		{ "handler", required_argument, NULL, 'H' },
+		{ "threads", required_argument, NULL, 'T' },
+		{ "pin-cpus", no_argument, NULL, 'P' },
+		{ "timing", no_argument, NULL, 'i' },
+		{ "metrics", required_argument, NULL, 'M' },
 		{ 0, },	/* NULL terminated */
 	};
 
@@ -79,9 +107,26 @@ nnio_options_parse(int argc, char *argv[], nnio_options_t *options)
 	options->socket_name = NULL;
 	options->local_endpoint = NULL;
 	options->remote_endpoint = NULL;
-	options->exit_delay = 0;
+	options->drain_timeout = NNIO_DRAIN_TIMEOUT;
 	options->exec = NULL;
 	options->quite = 0;
+	options->workers = 0;
+	options->concurrency = 0;
+	options->stream = false;
+	options->chunk_size = 0;
+	options->max_messages = 0;
+	options->chunked = false;
+	options->file = NULL;
+	options->topics = NULL;
+	options->nr_topics = 0;
+	options->deadline = -1;
+	options->back_url = NULL;
+	options->agent = NULL;
+	options->handler = NULL;
+	options->threads = 0;
+	options->pin_cpus = false;
+	options->timing = false;
+	options->metrics = NULL;
 
 	while (1) {
 		int opt;
@@ -128,7 +173,7 @@ nnio_options_parse(int argc, char *argv[], nnio_options_t *options)
 			options->local_endpoint = &options->url;
 			break;
 		case 'e':
-			options->exit_delay = atoi(optarg);
+			options->drain_timeout = atoi(optarg);
 			break;
 		case 'E':
 			options->exec = optarg;
@@ -139,6 +184,59 @@ nnio_options_parse(int argc, char *argv[], nnio_options_t *options)
 		case 'd':
 			options->daemon = true;
 			break;
+		case 'w':
+			options->workers = atoi(optarg);
+			break;
+		case 'c':
+			options->concurrency = atoi(optarg);
+			break;
+		case 's':
+			options->stream = true;
+			break;
+		case 'k':
+			options->chunk_size = atoi(optarg);
+			break;
+		case 'm':
+			options->max_messages = strtoul(optarg, NULL, 0);
+			break;
+		case 'C':
+			options->chunked = true;
+			break;
+		case 'f':
+			options->file = optarg;
+			break;
+		case 'S':
+			options->topics = realloc(options->topics,
+						  (options->nr_topics + 1) *
+						  sizeof(*options->topics));
+			nnio_error_assert(options->topics,
+					  "Failed to allocate topics");
+			options->topics[options->nr_topics++] = optarg;
+			break;
+		case 'D':
+			options->deadline = atoi(optarg);
+			break;
+		case 'b':
+			options->back_url = optarg;
+			break;
+		case 'a':
+			options->agent = optarg;
+			break;
+		case 'H':
+			options->handler = optarg;
+			break;
+		case 'T':
+			options->threads = atoi(optarg);
+			break;
+		case 'P':
+			options->pin_cpus = true;
+			break;
+		case 'i':
+			options->timing = true;
+			break;
+		case 'M':
+			options->metrics = optarg;
+			break;
 		case 1:
 			options->url = optarg;
 			break;
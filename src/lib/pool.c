@@ -0,0 +1,225 @@
+/*
+ * Persistent worker pool
+ *
+ * Copyright (c) 2016, Wind River Systems, Inc.
+ * All rights reserved.
+ *
+ * See "LICENSE" for license terms.
+ *
+ * Author:
+ *	  Lans Zhang <jia.zhang@windriver.com>
+ */
+
+#include <nnio.h>
+
+/*
+ * The workers are started once and reused for all requests. Each request
+ * and reply is framed on the stdin/stdout of a worker as a 32-bit length in
+ * network byte order followed by the payload. A worker is expected to read
+ * a whole request before writing its reply. A worker is restarted only if
+ * it exits or breaks the framing.
+ */
+
+typedef struct {
+	pid_t pid;
+	uint64_t started;
+	int in_fd;	/* The stdin of worker */
+	int out_fd;	/* The stdout of worker */
+} nnio_pool_worker_t;
+
+struct nnio_pool {
+	const char *exec;
+	unsigned int nr_workers;
+	unsigned int next;
+	nnio_pool_worker_t *workers;
+};
+
+static void
+start_worker(nnio_pool_t *pool, nnio_pool_worker_t *worker)
+{
+	int input_fds[2], output_fds[2];
+	int rc;
+
+	/* Don't leak the pipes of a worker to others */
+	rc = pipe2(input_fds, O_CLOEXEC);
+	nnio_error_assert(rc >= 0, "Error on creating the pipe for input");
+
+	rc = pipe2(output_fds, O_CLOEXEC);
+	nnio_error_assert(rc >= 0, "Error on creating the pipe for output");
+
+	worker->started = nnio_spawn_started();
+
+	/* The worker shares the stderr with the caller */
+	pid_t child = nnio_spawn_process(pool->exec, input_fds[0],
+					 output_fds[1], -1);
+	nnio_error_assert((int)child >= 0, "Error on executing worker %s",
+			  pool->exec);
+
+	close(input_fds[0]);
+	close(output_fds[1]);
+
+	worker->pid = child;
+	worker->in_fd = input_fds[1];
+	worker->out_fd = output_fds[0];
+
+	dbg("worker %d started\n", child);
+}
+
+static void
+stop_worker(nnio_pool_worker_t *worker)
+{
+	/* The worker is supposed to exit on stdin EOF */
+	close(worker->in_fd);
+	close(worker->out_fd);
+
+	int status = 0;
+
+	if (waitpid(worker->pid, &status, WNOHANG) == 0) {
+		kill(worker->pid, SIGTERM);
+		waitpid(worker->pid, &status, 0);
+	}
+
+	nnio_spawn_exited(worker->pid, status, worker->started);
+
+	dbg("worker %d stopped\n", worker->pid);
+
+	worker->pid = -1;
+}
+
+static int
+write_full(int fd, const void *buf, size_t len)
+{
+	while (len) {
+		ssize_t sz = write(fd, buf, len);
+		if (sz < 0) {
+			if (errno == EINTR)
+				continue;
+
+			return -1;
+		}
+
+		buf += sz;
+		len -= sz;
+	}
+
+	return 0;
+}
+
+static int
+read_full(int fd, void *buf, size_t len)
+{
+	while (len) {
+		ssize_t sz = read(fd, buf, len);
+		if (sz < 0) {
+			if (errno == EINTR)
+				continue;
+
+			return -1;
+		}
+
+		/* The worker exited */
+		if (!sz)
+			return -1;
+
+		buf += sz;
+		len -= sz;
+	}
+
+	return 0;
+}
+
+nnio_pool_t *
+nnio_pool_create(const char *exec, unsigned int nr_workers)
+{
+	nnio_pool_t *pool = calloc(1, sizeof(*pool));
+	nnio_error_assert(pool, "Failed to allocate pool");
+
+	pool->workers = calloc(nr_workers, sizeof(*pool->workers));
+	nnio_error_assert(pool->workers, "Failed to allocate workers");
+
+	pool->exec = exec;
+	pool->nr_workers = nr_workers;
+	/* Also ignores SIGPIPE to detect the exited worker through EPIPE */
+	nnio_spawn_prepare(exec);
+
+	for (unsigned int i = 0; i < nr_workers; ++i)
+		start_worker(pool, pool->workers + i);
+
+	return pool;
+}
+
+void
+nnio_pool_destroy(nnio_pool_t *pool)
+{
+	for (unsigned int i = 0; i < pool->nr_workers; ++i)
+		stop_worker(pool->workers + i);
+
+	free(pool->workers);
+	free(pool);
+}
+
+/*
+ * Run a request on the next worker and wait for its reply. The reply is
+ * allocated by nnio_alloc_data() and NULL is returned in out for an empty
+ * reply. Return -1 if the worker failed, in which case it is restarted.
+ */
+int
+nnio_pool_exec(nnio_pool_t *pool, void *data, unsigned int data_len,
+	       void **out, unsigned int *out_len)
+{
+	nnio_pool_worker_t *worker = pool->workers + pool->next;
+
+	pool->next = (pool->next + 1) % pool->nr_workers;
+
+	int status;
+
+	/* Restart the worker exited since the last request */
+	if (waitpid(worker->pid, &status, WNOHANG) == worker->pid) {
+		dbg("worker %d exited\n", worker->pid);
+		nnio_spawn_exited(worker->pid, status, worker->started);
+
+		close(worker->in_fd);
+		close(worker->out_fd);
+		start_worker(pool, worker);
+	}
+
+	*out = NULL;
+	*out_len = 0;
+
+	uint32_t len = htonl(data_len);
+	if (write_full(worker->in_fd, &len, sizeof(len)) ||
+	    write_full(worker->in_fd, data, data_len)) {
+		err("Failed to feed worker %d\n", worker->pid);
+		goto err_worker;
+	}
+
+	if (read_full(worker->out_fd, &len, sizeof(len))) {
+		err("Failed to read reply from worker %d\n", worker->pid);
+		goto err_worker;
+	}
+
+	len = ntohl(len);
+	if (!len)
+		return 0;
+
+	void *buf = nnio_alloc_data(len);
+	nnio_error_assert(buf, "Failed to allocate reply");
+
+	if (read_full(worker->out_fd, buf, len)) {
+		err("Failed to read %d-byte reply from worker %d\n", len,
+		    worker->pid);
+		nnio_free_data(buf);
+		goto err_worker;
+	}
+
+	*out = buf;
+	*out_len = len;
+
+	return 0;
+
+err_worker:
+	stop_worker(worker);
+	start_worker(pool, worker);
+
+	return -1;
+}
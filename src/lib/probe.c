@@ -0,0 +1,59 @@
+/*
+ * USDT probes
+ *
+ * Copyright (c) 2016, Wind River Systems, Inc.
+ * All rights reserved.
+ *
+ * See "LICENSE" for license terms.
+ *
+ * Author:
+ *	  Lans Zhang <jia.zhang@windriver.com>
+ */
+
+#include <nnio.h>
+#include "probe.h"
+
+#ifdef NNIO_PROBES
+NNIO_PROBE_SEMAPHORE(rx_entry);
+NNIO_PROBE_SEMAPHORE(rx_exit);
+NNIO_PROBE_SEMAPHORE(tx_entry);
+NNIO_PROBE_SEMAPHORE(tx_exit);
+NNIO_PROBE_SEMAPHORE(spawn_fork);
+NNIO_PROBE_SEMAPHORE(spawn_exec);
+NNIO_PROBE_SEMAPHORE(spawn_exit);
+NNIO_PROBE_SEMAPHORE(endpoint_bind);
+NNIO_PROBE_SEMAPHORE(endpoint_connect);
+NNIO_PROBE_SEMAPHORE(endpoint_shutdown);
+#endif
+
+/* Return the time in nanosecond for the durations carried by the probes */
+uint64_t
+nnio_probe_clock(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Return the time in nanosecond at which a child is about to start, or 0
+ * without reading the clock if spawn_exit is not traced.
+ */
+uint64_t
+nnio_spawn_started(void)
+{
+	return nnio_probe_enabled(spawn_exit) ? nnio_probe_clock() : 0;
+}
+
+/*
+ * Fire spawn_exit for a child reaped by the caller. The duration is 0 if
+ * the tracing started after the child.
+ */
+void
+nnio_spawn_exited(pid_t pid, int status, uint64_t started)
+{
+	nnio_probe3(spawn_exit, pid, status,
+		    started ? nnio_probe_clock() - started : 0);
+}
@@ -0,0 +1,79 @@
+/*
+ * USDT probes
+ *
+ * Copyright (c) 2016, Wind River Systems, Inc.
+ * All rights reserved.
+ *
+ * See "LICENSE" for license terms.
+ *
+ * Author:
+ *	  Lans Zhang <jia.zhang@windriver.com>
+ */
+
+#ifndef NNIO_PROBE_H
+#define NNIO_PROBE_H
+
+/*
+ * USDT probes of the provider nanoio for perf and bpftrace. A probe is a
+ * nop in the code plus a note in .note.stapsdt, so it costs nothing until
+ * it is attached. Without sys/sdt.h the arguments are only evaluated.
+ *
+ * The tracer counts itself in the semaphore of a probe, defined in probe.c,
+ * so an argument costing more than a nop, e.g, a duration, is only worked
+ * out if nnio_probe_enabled(). The probes live in libnanoio only, so this
+ * header is private to it and sys/sdt.h isn't exposed to the users of
+ * nnio.h.
+ */
+#if !defined(NNIO_NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define _SDT_HAS_SEMAPHORES	1
+#include <sys/sdt.h>
+#define NNIO_PROBES
+#endif
+#endif
+
+#ifdef NNIO_PROBES
+#define NNIO_PROBE_SEMAPHORE(name)	\
+	unsigned short nanoio_##name##_semaphore	\
+	__attribute__((unused, section(".probes")))
+
+extern NNIO_PROBE_SEMAPHORE(rx_entry);
+extern NNIO_PROBE_SEMAPHORE(rx_exit);
+extern NNIO_PROBE_SEMAPHORE(tx_entry);
+extern NNIO_PROBE_SEMAPHORE(tx_exit);
+extern NNIO_PROBE_SEMAPHORE(spawn_fork);
+extern NNIO_PROBE_SEMAPHORE(spawn_exec);
+extern NNIO_PROBE_SEMAPHORE(spawn_exit);
+extern NNIO_PROBE_SEMAPHORE(endpoint_bind);
+extern NNIO_PROBE_SEMAPHORE(endpoint_connect);
+extern NNIO_PROBE_SEMAPHORE(endpoint_shutdown);
+
+#define nnio_probe_enabled(name)	\
+	__builtin_expect(nanoio_##name##_semaphore, 0)
+#define nnio_probe1(name, a1)		STAP_PROBE1(nanoio, name, a1)
+#define nnio_probe2(name, a1, a2)	STAP_PROBE2(nanoio, name, a1, a2)
+#define nnio_probe3(name, a1, a2, a3)	\
+	STAP_PROBE3(nanoio, name, a1, a2, a3)
+#else
+#define nnio_probe_enabled(name)	false
+#define nnio_probe1(name, a1)	\
+	do {	\
+		(void)(a1);	\
+	} while (0)
+#define nnio_probe2(name, a1, a2)	\
+	do {	\
+		(void)(a1);	\
+		(void)(a2);	\
+	} while (0)
+#define nnio_probe3(name, a1, a2, a3)	\
+	do {	\
+		(void)(a1);	\
+		(void)(a2);	\
+		(void)(a3);	\
+	} while (0)
+#endif
+
+uint64_t
+nnio_probe_clock(void);
+
+#endif	/* NNIO_PROBE_H */
@@ -11,14 +11,52 @@
  */
 
 #include <nnio.h>
+#include "probe.h"
 
-int
-nnio_socket_open(int protocol, int tx_timeout, int rx_timeout,
-		 const char *socket_name, int linger_timeout)
+static void
+count_tx(int sock, unsigned long len)
+{
+	nnio_stats_add(sock, NNIO_STAT_TX_MSGS, 1);
+	nnio_stats_add(sock, NNIO_STAT_TX_BYTES, len);
+}
+
+static void
+count_rx(int sock, unsigned long len)
+{
+	nnio_stats_add(sock, NNIO_STAT_RX_MSGS, 1);
+	nnio_stats_add(sock, NNIO_STAT_RX_BYTES, len);
+}
+
+/* Count the error of a tx or rx on the socket and return it */
+static int
+count_error(int sock, int err, bool tx)
+{
+	switch (err) {
+	case EINTR:
+		nnio_stats_add(sock, NNIO_STAT_EINTR, 1);
+		break;
+	case ETIMEDOUT:
+		nnio_stats_add(sock, tx ? NNIO_STAT_TX_TIMEOUTS :
+				    NNIO_STAT_RX_TIMEOUTS, 1);
+		break;
+	case EAGAIN:
+		nnio_stats_add(sock, tx ? NNIO_STAT_TX_EAGAIN :
+				    NNIO_STAT_RX_EAGAIN, 1);
+		break;
+	default:
+		break;
+	}
+
+	return err;
+}
+
+static int
+socket_open(int domain, int protocol, int tx_timeout, int rx_timeout,
+	    const char *socket_name, int linger_timeout)
 {
 	int sock;
 
-	sock = nn_socket(AF_SP, protocol);
+	sock = nn_socket(domain, protocol);
 	nnio_error_assert(sock >= 0, "Unable to create socket");
 
 	nnio_socket_set_tx_timeout(sock, tx_timeout);
@@ -26,14 +64,40 @@ nnio_socket_open(int protocol, int tx_timeout, int rx_timeout,
 	nnio_socket_set_name(sock, socket_name);
 	nnio_socket_set_linger_timeout(sock, linger_timeout);
 
+	nnio_stats_open(sock, protocol, socket_name);
+
 	return sock;
 }
 
+int
+nnio_socket_open(int protocol, int tx_timeout, int rx_timeout,
+		 const char *socket_name, int linger_timeout)
+{
+	return socket_open(AF_SP, protocol, tx_timeout, rx_timeout,
+			   socket_name, linger_timeout);
+}
+
+/*
+ * Open a raw socket. A raw socket doesn't maintain the protocol state, so
+ * for instance a raw NN_REP socket is able to receive the next request
+ * before replying the previous one. The caller is responsible for passing
+ * the protocol header through nnio_socket_rx_raw() and nnio_socket_tx_raw().
+ */
+int
+nnio_socket_open_raw(int protocol, int tx_timeout, int rx_timeout,
+		     const char *socket_name, int linger_timeout)
+{
+	return socket_open(AF_SP_RAW, protocol, tx_timeout, rx_timeout,
+			   socket_name, linger_timeout);
+}
+
 void
 nnio_socket_close(int sock)
 {
 	int err;
 
+	nnio_stats_close(sock);
+
 	do {
 		int rc = nn_close(sock);
 		if (!rc)
@@ -46,6 +110,63 @@ nnio_socket_close(int sock)
 	nnio_error_assert(0, "Unable to close socket");
 }
 
+/*
+ * Wait, on a best effort basis, until the messages sent are written out
+ * before closing the socket. nanomsg doesn't support the linger timeout, so
+ * nn_close() drops whatever is still queued, and there is no acknowledgement
+ * from the receiver. A pipe only becomes writable again once its previous
+ * message is handed over to the transport, but NN_POLLOUT only tells that
+ * one of the pipes can take a message. So it is waited for on a socket with
+ * a single pipe only, i.e, a pair socket or a push socket with at most one
+ * connection. A pub or bus socket is always writable and a push socket with
+ * more peers can't tell, so they are not waited for. The sockets in the
+ * request-reply or survey pattern, or those only receiving, have no message
+ * pending once their peers replied or are waiting for the next one.
+ *
+ * Return -1 if the timeout in millisecond expires, or 0 otherwise.
+ */
+int
+nnio_socket_drain(int sock, int timeout)
+{
+	int protocol;
+	size_t sz = sizeof(protocol);
+
+	int rc = nn_getsockopt(sock, NN_SOL_SOCKET, NN_PROTOCOL, &protocol,
+			       &sz);
+	nnio_error_assert(!rc, "Unable to get NN_PROTOCOL");
+
+	switch (protocol) {
+	case NN_PAIR:
+		break;
+	case NN_PUSH:
+		if (nn_get_statistic(sock, NN_STAT_CURRENT_CONNECTIONS) <= 1)
+			break;
+
+		dbg("unable to drain socket with more than one peer\n");
+		return 0;
+	default:
+		return 0;
+	}
+
+	struct nn_pollfd pfd = {
+		.fd = sock,
+		.events = NN_POLLOUT,
+	};
+
+	dbg("draining socket ...\n");
+
+	do {
+		rc = nn_poll(&pfd, 1, timeout);
+	} while (rc < 0 && nn_errno() == EINTR);
+
+	if (rc <= 0) {
+		err("Timeout for draining socket\n");
+		return -1;
+	}
+
+	return 0;
+}
+
 int
 nnio_socket_set_tx_timeout(int sock, int timeout)
 {
@@ -98,21 +219,54 @@ nnio_socket_set_name(int sock, const char *name)
 	return rc;
 }
 
+/* Subscribe a NN_SUB socket to the messages starting with topic */
+int
+nnio_socket_subscribe(int sock, const char *topic)
+{
+	int rc = nn_setsockopt(sock, NN_SUB, NN_SUB_SUBSCRIBE, topic,
+			       strlen(topic));
+	nnio_error_assert(!rc, "Unable to subscribe topic %s", topic);
+
+	return rc;
+}
+
+/* Set how long a NN_SURVEYOR socket collects the responses to a survey */
+int
+nnio_socket_set_deadline(int sock, int deadline)
+{
+	if (deadline < 0)
+		return -1;
+
+	int rc = nn_setsockopt(sock, NN_SURVEYOR, NN_SURVEYOR_DEADLINE,
+			       &deadline, sizeof(deadline));
+	nnio_error_assert(!rc, "Unable to set survey deadline");
+
+	return rc;
+}
+
 int
 nnio_socket_tx(int sock, void *data, unsigned int data_len)
 {
+	uint64_t start = nnio_timing_start();
 	int err;
 
+	nnio_probe2(tx_entry, sock, data_len);
+
 	do {
 		int rc = nn_send(sock, data, data_len, 0);
 		if (rc >= 0) {
 			dbg("sending %d-byte data ...\n", rc);
+			nnio_timing_end(NNIO_PHASE_TX, start);
+			count_tx(sock, rc);
+			nnio_probe3(tx_exit, sock, rc, 0);
 			return rc;
 		}
 
-		err = nn_errno();
+		err = count_error(sock, nn_errno(), true);
 	} while (err == EINTR);
 
+	nnio_probe3(tx_exit, sock, -1, err);
+
 	if (err == ETIMEDOUT) {
 		dbg("Tx timeout\n");
 		return -1;
@@ -133,18 +287,24 @@ nnio_socket_rx(int sock, void **data, unsigned int *data_len)
 {
 	int err;
 
+	nnio_probe1(rx_entry, sock);
+
 	do {
 		int len = nn_recv(sock, data, NN_MSG, 0);
 		if (len >= 0) {
 			/* nn_recv() may leak EAGAIN sometimes */
 			errno = 0;
 			*data_len = len;
+			count_rx(sock, len);
+			nnio_probe3(rx_exit, sock, len, 0);
 			return len;
 		}
 
-		err = nn_errno();
+		err = count_error(sock, nn_errno(), false);
 	} while (err == EINTR);
 
+	nnio_probe3(rx_exit, sock, -1, err);
+
 	if (err == ETIMEDOUT) {
 		dbg("Rx timeout\n");
 		return -1;
@@ -165,6 +325,9 @@ nnio_socket_tx_iov(int sock, struct nn_iovec *iov, unsigned int nr_iov)
 {
 	struct nn_msghdr hdr;
 
+	/* The length of iov is not known until it is sent */
+	nnio_probe2(tx_entry, sock, -1);
+
 	memset(&hdr, 0, sizeof(hdr));
 	hdr.msg_iov = iov;
 	hdr.msg_iovlen = nr_iov;
@@ -173,12 +336,17 @@ nnio_socket_tx_iov(int sock, struct nn_iovec *iov, unsigned int nr_iov)
 
 	do {
 		int len = nn_sendmsg(sock, &hdr, 0);
-		if (len >= 0)
+		if (len >= 0) {
+			count_tx(sock, len);
+			nnio_probe3(tx_exit, sock, len, 0);
 			return len;
+		}
 
-		err = nn_errno();
+		err = count_error(sock, nn_errno(), true);
 	} while (err == EINTR);
 
+	nnio_probe3(tx_exit, sock, -1, err);
+
 	if (err == ETIMEDOUT) {
 		dbg("Tx iov timeout\n");
 		return -1;
@@ -193,3 +361,420 @@ nnio_socket_tx_iov(int sock, struct nn_iovec *iov, unsigned int nr_iov)
 
 	return -1;
 }
+
+/*
+ * Send a message allocated by nnio_alloc_data() without copying it.
+ *
+ * On success the ownership of msg is passed to nanomsg and the caller must
+ * not access or free it any more. On failure the caller still owns msg.
+ * Note that msg_len must be equal to the size of msg because nanomsg
+ * always sends the whole buffer. Use nnio_realloc_data() to trim it if
+ * necessary.
+ */
+int
+nnio_socket_tx_msg(int sock, void *msg, unsigned int msg_len)
+{
+	uint64_t start = nnio_timing_start();
+	int err;
+
+	nnio_probe2(tx_entry, sock, msg_len);
+
+	do {
+		int rc = nn_send(sock, &msg, NN_MSG, 0);
+		if (rc >= 0) {
+			dbg("sending %d-byte message ...\n", rc);
+			nnio_timing_end(NNIO_PHASE_TX, start);
+			count_tx(sock, rc);
+			nnio_probe3(tx_exit, sock, rc, 0);
+			return rc;
+		}
+
+		err = count_error(sock, nn_errno(), true);
+	} while (err == EINTR);
+
+	nnio_probe3(tx_exit, sock, -1, err);
+
+	if (err == ETIMEDOUT) {
+		dbg("Tx msg timeout\n");
+		return -1;
+	}
+
+	if (err == EAGAIN) {
+		err("Try to tx msg again\n");
+		return -1;
+	}
+
+	nnio_error_assert(0, "Failed to send the %d-byte message", msg_len);
+
+	return -1;
+}
+
+/*
+ * Receive up to nr_msgs messages into msgs[]. Only the first receive
+ * blocks with the rx timeout; the rest of slots are filled with the
+ * messages already queued on the socket.
+ *
+ * Return the number of received messages, or -1 if nothing is received.
+ * Each received message must be freed by nnio_free_data().
+ */
+int
+nnio_socket_rx_batch(int sock, nnio_msg_t *msgs, unsigned int nr_msgs)
+{
+	unsigned int nr_rx = 0;
+	int flags = 0;
+	int err;
+
+	while (nr_rx < nr_msgs) {
+		void *data;
+
+		nnio_probe1(rx_entry, sock);
+
+		int len = nn_recv(sock, &data, NN_MSG, flags);
+		if (len >= 0) {
+			msgs[nr_rx].data = data;
+			msgs[nr_rx++].data_len = len;
+			flags = NN_DONTWAIT;
+			count_rx(sock, len);
+			nnio_probe3(rx_exit, sock, len, 0);
+			continue;
+		}
+
+		err = nn_errno();
+		nnio_probe3(rx_exit, sock, -1, err);
+
+		/* The queue is drained */
+		if (err == EAGAIN && flags == NN_DONTWAIT)
+			break;
+
+		if (count_error(sock, err, false) == EINTR)
+			continue;
+
+		if (err == ETIMEDOUT) {
+			dbg("Rx batch timeout\n");
+			break;
+		}
+
+		if (err == EAGAIN) {
+			err("Try to rx batch again\n");
+			break;
+		}
+
+		nnio_error_assert(0, "Failed to receive the batch");
+	}
+
+	/* nn_recv() may leak EAGAIN sometimes */
+	if (nr_rx)
+		errno = 0;
+
+	dbg("received %d messages in batch\n", nr_rx);
+
+	return nr_rx ? (int)nr_rx : -1;
+}
+
+/*
+ * Send up to nr_msgs messages from msgs[] in zero-copy. Only the first send
+ * blocks with the tx timeout; the rest of messages are sent as long as the
+ * socket doesn't push back.
+ *
+ * Return the number of sent messages, or -1 if nothing is sent. The
+ * ownership of the sent messages is passed to nanomsg, and the slots of
+ * them are cleared. The unsent messages are still owned by the caller.
+ */
+int
+nnio_socket_tx_batch(int sock, nnio_msg_t *msgs, unsigned int nr_msgs)
+{
+	unsigned int nr_tx = 0;
+	int flags = 0;
+	int err;
+
+	while (nr_tx < nr_msgs) {
+		nnio_probe2(tx_entry, sock, msgs[nr_tx].data_len);
+
+		int rc = nn_send(sock, &msgs[nr_tx].data, NN_MSG, flags);
+		if (rc >= 0) {
+			msgs[nr_tx].data = NULL;
+			msgs[nr_tx++].data_len = 0;
+			flags = NN_DONTWAIT;
+			count_tx(sock, rc);
+			nnio_probe3(tx_exit, sock, rc, 0);
+			continue;
+		}
+
+		err = nn_errno();
+		nnio_probe3(tx_exit, sock, -1, err);
+
+		/* The peer is not ready for more */
+		if (err == EAGAIN && flags == NN_DONTWAIT)
+			break;
+
+		if (count_error(sock, err, true) == EINTR)
+			continue;
+
+		if (err == ETIMEDOUT) {
+			dbg("Tx batch timeout\n");
+			break;
+		}
+
+		if (err == EAGAIN) {
+			err("Try to tx batch again\n");
+			break;
+		}
+
+		nnio_error_assert(0, "Failed to send the batch");
+	}
+
+	dbg("sent %d messages in batch\n", nr_tx);
+
+	return nr_tx ? (int)nr_tx : -1;
+}
+
+/*
+ * Receive a message from a raw socket along with its protocol header, e.g,
+ * the backtrace of a request on a raw NN_REP socket. Both data and header
+ * must be freed by nnio_free_data() unless they are passed on to
+ * nnio_socket_tx_raw().
+ */
+int
+nnio_socket_rx_raw(int sock, void **data, unsigned int *data_len,
+		   void **header, int flags)
+{
+	struct nn_msghdr hdr;
+	struct nn_iovec iov;
+	int err;
+
+	nnio_probe1(rx_entry, sock);
+
+	iov.iov_base = data;
+	iov.iov_len = NN_MSG;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.msg_iov = &iov;
+	hdr.msg_iovlen = 1;
+	hdr.msg_control = header;
+	hdr.msg_controllen = NN_MSG;
+
+	do {
+		int len = nn_recvmsg(sock, &hdr, flags);
+		if (len >= 0) {
+			/* nn_recvmsg() may leak EAGAIN sometimes */
+			errno = 0;
+			*data_len = len;
+			count_rx(sock, len);
+			nnio_probe3(rx_exit, sock, len, 0);
+			return len;
+		}
+
+		err = count_error(sock, nn_errno(), false);
+	} while (err == EINTR);
+
+	nnio_probe3(rx_exit, sock, -1, err);
+
+	if (err == ETIMEDOUT) {
+		dbg("Rx raw timeout\n");
+		return -1;
+	}
+
+	if (err == EAGAIN) {
+		if (!(flags & NN_DONTWAIT))
+			err("Try to rx raw again\n");
+		return -1;
+	}
+
+	nnio_error_assert(0, "Failed to receive the raw data");
+
+	return -1;
+}
+
+/*
+ * Send a message to a raw socket with the protocol header received by
+ * nnio_socket_rx_raw(). Both data and header are sent in zero-copy and
+ * the ownership of them is passed to nanomsg on success. Pass NULL in data
+ * to send an empty message, and NULL in header if there is no header to
+ * pass on.
+ */
+int
+nnio_socket_tx_raw(int sock, void *data, unsigned int data_len, void *header)
+{
+	struct nn_msghdr hdr;
+	struct nn_iovec iov;
+	int err;
+
+	nnio_probe2(tx_entry, sock, data_len);
+
+	if (data) {
+		iov.iov_base = &data;
+		iov.iov_len = NN_MSG;
+	} else {
+		iov.iov_base = "";
+		iov.iov_len = 0;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.msg_iov = &iov;
+	hdr.msg_iovlen = 1;
+	if (header) {
+		hdr.msg_control = &header;
+		hdr.msg_controllen = NN_MSG;
+	}
+
+	uint64_t start = nnio_timing_start();
+
+	do {
+		int len = nn_sendmsg(sock, &hdr, 0);
+		if (len >= 0) {
+			dbg("sending %d-byte raw data ...\n", len);
+			nnio_timing_end(NNIO_PHASE_TX, start);
+			count_tx(sock, len);
+			nnio_probe3(tx_exit, sock, len, 0);
+			return len;
+		}
+
+		err = count_error(sock, nn_errno(), true);
+	} while (err == EINTR);
+
+	nnio_probe3(tx_exit, sock, -1, err);
+
+	if (err == ETIMEDOUT) {
+		dbg("Tx raw timeout\n");
+		return -1;
+	}
+
+	if (err == EAGAIN) {
+		err("Try to tx raw again\n");
+		return -1;
+	}
+
+	nnio_error_assert(0, "Failed to send the %d-byte raw data", data_len);
+
+	return -1;
+}
+
+/*
+ * Send one message of a stream of replies to the same request. Unlike
+ * nnio_socket_tx_raw(), the header is copied by nanomsg so it can be used
+ * for the subsequent messages, and must be freed by the caller at the end.
+ */
+int
+nnio_socket_tx_raw_stream(int sock, void *data, unsigned int data_len,
+			  void *header)
+{
+	struct nn_msghdr hdr;
+	struct nn_iovec iov;
+	int err;
+
+	nnio_probe2(tx_entry, sock, data_len);
+
+	if (data) {
+		iov.iov_base = &data;
+		iov.iov_len = NN_MSG;
+	} else {
+		iov.iov_base = "";
+		iov.iov_len = 0;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.msg_iov = &iov;
+	hdr.msg_iovlen = 1;
+	hdr.msg_control = &header;
+	hdr.msg_controllen = NN_MSG;
+
+	/* The protocol header is always the first one. Pass it by value. */
+	struct nn_cmsghdr *cmsg = NN_CMSG_FIRSTHDR(&hdr);
+	nnio_error_assert(cmsg, "No protocol header for stream");
+
+	hdr.msg_control = header;
+	hdr.msg_controllen = NN_CMSG_ALIGN_(cmsg->cmsg_len);
+
+	uint64_t start = nnio_timing_start();
+
+	do {
+		int len = nn_sendmsg(sock, &hdr, 0);
+		if (len >= 0) {
+			dbg("sending %d-byte raw stream data ...\n", len);
+			nnio_timing_end(NNIO_PHASE_TX, start);
+			count_tx(sock, len);
+			nnio_probe3(tx_exit, sock, len, 0);
+			return len;
+		}
+
+		err = count_error(sock, nn_errno(), true);
+	} while (err == EINTR);
+
+	nnio_probe3(tx_exit, sock, -1, err);
+
+	if (err == ETIMEDOUT) {
+		dbg("Tx raw stream timeout\n");
+		return -1;
+	}
+
+	if (err == EAGAIN) {
+		err("Try to tx raw stream again\n");
+		return -1;
+	}
+
+	nnio_error_assert(0, "Failed to send the %d-byte raw stream data",
+			  data_len);
+
+	return -1;
+}
+
+/*
+ * Construct a protocol header for a raw socket from the raw bytes, e.g,
+ * the 32-bit request id for a raw NN_REQ socket. The returned header is
+ * consumed by nnio_socket_tx_raw().
+ */
+void *
+nnio_socket_header(const void *sphdr, unsigned int sphdr_len)
+{
+	size_t len = sphdr_len;
+	size_t cmsg_len = NN_CMSG_LEN(sizeof(len) + len);
+
+	struct nn_cmsghdr *cmsg = nnio_alloc_data(NN_CMSG_SPACE(sizeof(len) +
+								len));
+	nnio_error_assert(cmsg, "Failed to allocate protocol header");
+
+	cmsg->cmsg_len = cmsg_len;
+	cmsg->cmsg_level = PROTO_SP;
+	cmsg->cmsg_type = SP_HDR;
+	memcpy(NN_CMSG_DATA(cmsg), &len, sizeof(len));
+	memcpy(NN_CMSG_DATA(cmsg) + sizeof(len), sphdr, len);
+
+	return cmsg;
+}
+
+/*
+ * Forward the messages along with their protocol headers from a raw socket
+ * to another until *exiting is set, in the same way as nn_device() but
+ * without the need of nn_term() to stop it. Both sockets should have the
+ * timeouts set so that the exiting is checked periodically. The number of
+ * messages and bytes forwarded are updated atomically.
+ */
+void
+nnio_forward(nnio_forward_t *fwd)
+{
+	/* The hops between the front-end and workers are not a phase */
+	nnio_timing_exclude_thread();
+
+	while (!__atomic_load_n(fwd->exiting, __ATOMIC_RELAXED)) {
+		void *data;
+		unsigned int data_len;
+		void *header;
+
+		if (nnio_socket_rx_raw(fwd->rx_sock, &data, &data_len, &header,
+				       0) < 0)
+			continue;
+
+		/* Hold on until the peer is able to accept it */
+		while (nnio_socket_tx_raw(fwd->tx_sock, data, data_len,
+					  header) < 0) {
+			if (__atomic_load_n(fwd->exiting, __ATOMIC_RELAXED)) {
+				nnio_free_data(data);
+				nnio_free_data(header);
+				return;
+			}
+		}
+
+		__atomic_add_fetch(&fwd->nr_msgs, 1, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&fwd->nr_bytes, data_len, __ATOMIC_RELAXED);
+	}
+}
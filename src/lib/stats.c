@@ -0,0 +1,312 @@
+/*
+ * Socket statistics
+ *
+ * Copyright (c) 2016, Wind River Systems, Inc.
+ * All rights reserved.
+ *
+ * See "LICENSE" for license terms.
+ *
+ * Author:
+ *	  Lans Zhang <jia.zhang@windriver.com>
+ */
+
+#include <nnio.h>
+
+/*
+ * The counters of each socket are indexed by the socket number, which is
+ * below the default NN_MAX_SOCKETS of nanomsg, and updated with relaxed
+ * atomics so any thread using the socket is able to count at the cost of
+ * an uncontended add. The sockets beyond the table are not counted.
+ */
+
+#define STATS_MAX_SOCKETS	512
+
+/* The delay before serving again after a persistent failure, in usec */
+#define STATS_RETRY_DELAY	100000
+
+typedef struct {
+	bool open;
+	int protocol;
+	char name[64];
+	unsigned long counters[NNIO_NR_STATS];
+} socket_stats_t;
+
+static struct {
+	const char *name;
+	const char *help;
+} stat_metrics[NNIO_NR_STATS] = {
+	[NNIO_STAT_TX_MSGS] = {
+		"nnio_socket_sent_messages_total",
+		"Messages sent by the socket.",
+	},
+	[NNIO_STAT_TX_BYTES] = {
+		"nnio_socket_sent_bytes_total",
+		"Bytes sent by the socket.",
+	},
+	[NNIO_STAT_RX_MSGS] = {
+		"nnio_socket_received_messages_total",
+		"Messages received by the socket.",
+	},
+	[NNIO_STAT_RX_BYTES] = {
+		"nnio_socket_received_bytes_total",
+		"Bytes received by the socket.",
+	},
+	[NNIO_STAT_TX_TIMEOUTS] = {
+		"nnio_socket_tx_timeouts_total",
+		"Sends timed out with ETIMEDOUT.",
+	},
+	[NNIO_STAT_RX_TIMEOUTS] = {
+		"nnio_socket_rx_timeouts_total",
+		"Receives timed out with ETIMEDOUT.",
+	},
+	[NNIO_STAT_TX_EAGAIN] = {
+		"nnio_socket_tx_eagain_total",
+		"Sends failed with EAGAIN.",
+	},
+	[NNIO_STAT_RX_EAGAIN] = {
+		"nnio_socket_rx_eagain_total",
+		"Receives failed with EAGAIN.",
+	},
+	[NNIO_STAT_EINTR] = {
+		"nnio_socket_eintr_total",
+		"Sends and receives retried on EINTR.",
+	},
+};
+
+static socket_stats_t socket_stats[STATS_MAX_SOCKETS];
+
+void
+nnio_stats_open(int sock, int protocol, const char *name)
+{
+	if (sock < 0 || sock >= STATS_MAX_SOCKETS)
+		return;
+
+	socket_stats_t *s = socket_stats + sock;
+
+	for (unsigned int i = 0; i < NNIO_NR_STATS; ++i)
+		__atomic_store_n(s->counters + i, 0, __ATOMIC_RELAXED);
+
+	s->protocol = protocol;
+	snprintf(s->name, sizeof(s->name), "%s", name ? name : "");
+
+	__atomic_store_n(&s->open, true, __ATOMIC_RELEASE);
+}
+
+void
+nnio_stats_close(int sock)
+{
+	if (sock < 0 || sock >= STATS_MAX_SOCKETS)
+		return;
+
+	__atomic_store_n(&socket_stats[sock].open, false, __ATOMIC_RELEASE);
+}
+
+void
+nnio_stats_add(int sock, nnio_stat_t stat, unsigned long n)
+{
+	if (sock < 0 || sock >= STATS_MAX_SOCKETS)
+		return;
+
+	__atomic_add_fetch(socket_stats[sock].counters + stat, n,
+			   __ATOMIC_RELAXED);
+}
+
+/* Escape the backslash, double-quote and line feed in a label value */
+static void
+show_label(FILE *fp, const char *value)
+{
+	for (; *value; ++value) {
+		if (*value == '\\')
+			fputs("\\\\", fp);
+		else if (*value == '"')
+			fputs("\\\"", fp);
+		else if (*value == '\n')
+			fputs("\\n", fp);
+		else
+			fputc(*value, fp);
+	}
+}
+
+/*
+ * Write a snapshot of the counters of all open sockets in the Prometheus
+ * text format.
+ */
+void
+nnio_stats_show(FILE *fp)
+{
+	for (unsigned int i = 0; i < NNIO_NR_STATS; ++i) {
+		fprintf(fp, "# HELP %s %s\n", stat_metrics[i].name,
+			stat_metrics[i].help);
+		fprintf(fp, "# TYPE %s counter\n", stat_metrics[i].name);
+
+		for (int sock = 0; sock < STATS_MAX_SOCKETS; ++sock) {
+			socket_stats_t *s = socket_stats + sock;
+
+			if (!__atomic_load_n(&s->open, __ATOMIC_ACQUIRE))
+				continue;
+
+			fprintf(fp, "%s{socket=\"%d\",protocol=\"%s\","
+				"name=\"", stat_metrics[i].name, sock,
+				nnio_protocol_name(s->protocol));
+			show_label(fp, s->name);
+			fprintf(fp, "\"} %lu\n",
+				__atomic_load_n(s->counters + i,
+						__ATOMIC_RELAXED));
+		}
+	}
+}
+
+/* Return the snapshot in a buffer to be freed by the caller */
+static char *
+format_stats(size_t *len)
+{
+	char *text;
+	FILE *fp = open_memstream(&text, len);
+	nnio_error_assert(fp, "Failed to open memory stream");
+
+	nnio_stats_show(fp);
+	fclose(fp);
+
+	return text;
+}
+
+/* Reply each request on a NN_REP socket with the snapshot */
+static void *
+serve_socket(void *arg)
+{
+	int sock = (intptr_t)arg;
+
+	while (1) {
+		void *data;
+		unsigned int data_len;
+
+		/* Only EAGAIN and ETIMEDOUT are returned, the rest are fatal */
+		if (nnio_socket_rx(sock, &data, &data_len) < 0) {
+			usleep(STATS_RETRY_DELAY);
+			continue;
+		}
+
+		nnio_free_data(data);
+
+		size_t len;
+		char *text = format_stats(&len);
+
+		nnio_socket_tx(sock, text, len);
+		free(text);
+	}
+
+	return NULL;
+}
+
+/* Write the snapshot to each connection on a unix socket, then close it */
+static void *
+serve_unix(void *arg)
+{
+	int fd = (intptr_t)arg;
+
+	while (1) {
+		int conn = accept4(fd, NULL, NULL, SOCK_CLOEXEC);
+		if (conn < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+
+			/* Wait for the fds or memory to be released */
+			if (errno == EMFILE || errno == ENFILE ||
+			    errno == ENOBUFS || errno == ENOMEM) {
+				usleep(STATS_RETRY_DELAY);
+				continue;
+			}
+
+			err("Stop serving stats (%s)\n", strerror(errno));
+			break;
+		}
+
+		size_t len;
+		char *text = format_stats(&len);
+		struct iovec iov = {
+			.iov_base = text,
+			.iov_len = len,
+		};
+
+		nnio_write_iov(conn, &iov, 1);
+		free(text);
+		close(conn);
+	}
+
+	close(fd);
+
+	return NULL;
+}
+
+static int
+listen_unix(const char *path)
+{
+	struct sockaddr_un addr = {
+		.sun_family = AF_UNIX,
+	};
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		err("Stats path %s too long\n", path);
+		return -1;
+	}
+
+	strcpy(addr.sun_path, path);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	nnio_error_assert(fd >= 0, "Unable to create unix socket");
+
+	/* Take over the socket left by the previous instance */
+	unlink(path);
+
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+	    listen(fd, SOMAXCONN)) {
+		err("Unable to listen on %s (%s)\n", path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/*
+ * Serve the snapshot of socket counters in the Prometheus text format in a
+ * dedicated thread. The url is either "unix://<path>", on which each
+ * connection gets a snapshot, or a nanomsg url to bind a NN_REP socket
+ * replying a snapshot to any request.
+ */
+int
+nnio_stats_serve(const char *url)
+{
+	const char *prefix = "unix://";
+	int fd;
+
+	if (!strncmp(url, prefix, strlen(prefix))) {
+		fd = listen_unix(url + strlen(prefix));
+		if (fd < 0)
+			return -1;
+
+		if (nnio_thread_create(serve_unix, (void *)(intptr_t)fd)) {
+			close(fd);
+			return -1;
+		}
+
+		return 0;
+	}
+
+	fd = nnio_socket_open(NN_REP, -1, -1, NULL, -1);
+	if (fd < 0)
+		return -1;
+
+	if (nnio_endpoint_add_local(fd, url) < 0)
+		goto err;
+
+	if (nnio_thread_create(serve_socket, (void *)(intptr_t)fd))
+		goto err;
+
+	return 0;
+
+err:
+	nnio_socket_close(fd);
+
+	return -1;
+}
@@ -0,0 +1,220 @@
+/*
+ * Per-phase timing
+ *
+ * Copyright (c) 2016, Wind River Systems, Inc.
+ * All rights reserved.
+ *
+ * See "LICENSE" for license terms.
+ *
+ * Author:
+ *	  Lans Zhang <jia.zhang@windriver.com>
+ */
+
+#include <nnio.h>
+
+/*
+ * The duration of each phase is recorded into a log-linear histogram: each
+ * power of two of nanoseconds is split into 2^TIMING_SUB_BITS linear
+ * buckets, so any percentile is accurate to about 6% with a fixed table and
+ * no allocation on the hot path. The timing is compiled in but disabled by
+ * default, in which case a phase costs an atomic load without reading the
+ * clock.
+ */
+
+#define TIMING_SUB_BITS		4
+#define TIMING_SUB_BUCKETS	(1 << TIMING_SUB_BITS)
+#define TIMING_NR_BUCKETS	((64 - TIMING_SUB_BITS + 1) * TIMING_SUB_BUCKETS)
+
+typedef struct {
+	uint64_t count;
+	uint64_t max;
+	uint64_t buckets[TIMING_NR_BUCKETS];
+} timing_histogram_t;
+
+static const char *phase_names[NNIO_NR_PHASES] = {
+	[NNIO_PHASE_TX] = "tx",
+	[NNIO_PHASE_ARGV] = "argv",
+	[NNIO_PHASE_SPAWN] = "spawn",
+	[NNIO_PHASE_FEED] = "feed",
+	[NNIO_PHASE_OUTPUT] = "output",
+	[NNIO_PHASE_WAIT] = "wait",
+	[NNIO_PHASE_POOL] = "pool",
+	[NNIO_PHASE_HANDLER] = "handler",
+	[NNIO_PHASE_REQUEST] = "request",
+};
+
+static timing_histogram_t histograms[NNIO_NR_PHASES];
+static bool timing_enabled;
+static __thread bool thread_excluded;
+
+static unsigned int
+bucket_index(uint64_t ns)
+{
+	if (ns < TIMING_SUB_BUCKETS)
+		return ns;
+
+	unsigned int msb = 63 - __builtin_clzll(ns);
+	unsigned int shift = msb - TIMING_SUB_BITS;
+
+	return (shift + 1) * TIMING_SUB_BUCKETS +
+	       ((ns >> shift) & (TIMING_SUB_BUCKETS - 1));
+}
+
+/* Return the middle of the values falling into the bucket */
+static uint64_t
+bucket_value(unsigned int index)
+{
+	if (index < TIMING_SUB_BUCKETS)
+		return index;
+
+	unsigned int shift = index / TIMING_SUB_BUCKETS - 1;
+	uint64_t low = (uint64_t)(TIMING_SUB_BUCKETS +
+				  index % TIMING_SUB_BUCKETS) << shift;
+
+	return low + ((1ULL << shift) >> 1);
+}
+
+void
+nnio_timing_enable(bool enable)
+{
+	__atomic_store_n(&timing_enabled, enable, __ATOMIC_RELAXED);
+}
+
+bool
+nnio_timing_enabled(void)
+{
+	return __atomic_load_n(&timing_enabled, __ATOMIC_RELAXED);
+}
+
+/* Don't record the phases run by the calling thread, e.g, a forwarder */
+void
+nnio_timing_exclude_thread(void)
+{
+	thread_excluded = true;
+}
+
+/*
+ * Return the start time of a phase in nanosecond, or 0 if the timing is
+ * disabled, in which case the phase is not recorded by nnio_timing_end().
+ */
+uint64_t
+nnio_timing_start(void)
+{
+	if (!nnio_timing_enabled() || thread_excluded)
+		return 0;
+
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec + 1;
+}
+
+void
+nnio_timing_end(nnio_phase_t phase, uint64_t start)
+{
+	if (!start)
+		return;
+
+	uint64_t ns = nnio_timing_start();
+	if (!ns)
+		return;
+
+	ns = ns > start ? ns - start : 0;
+
+	timing_histogram_t *h = histograms + phase;
+
+	__atomic_add_fetch(&h->buckets[bucket_index(ns)], 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&h->count, 1, __ATOMIC_RELAXED);
+
+	uint64_t max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+	while (ns > max &&
+	       !__atomic_compare_exchange_n(&h->max, &max, ns, true,
+					    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+/*
+ * Return the value at the given permille with the nearest-rank method. The
+ * middle of the last bucket may go beyond the maximum really recorded.
+ */
+static uint64_t
+percentile(timing_histogram_t *h, uint64_t count, unsigned int permille)
+{
+	uint64_t max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+	uint64_t rank = (count * permille + 999) / 1000;
+	uint64_t seen = 0;
+
+	for (unsigned int i = 0; i < TIMING_NR_BUCKETS; ++i) {
+		seen += __atomic_load_n(&h->buckets[i], __ATOMIC_RELAXED);
+		if (seen >= rank)
+			return bucket_value(i) < max ? bucket_value(i) : max;
+	}
+
+	return max;
+}
+
+/* Show p50, p99 and p999 of each phase recorded so far, in microsecond */
+void
+nnio_timing_show(void)
+{
+	for (unsigned int i = 0; i < NNIO_NR_PHASES; ++i) {
+		timing_histogram_t *h = histograms + i;
+		uint64_t count = __atomic_load_n(&h->count, __ATOMIC_RELAXED);
+
+		if (!count)
+			continue;
+
+		info("%-8s %10ld samples, p50 %.1fus, p99 %.1fus, "
+		     "p999 %.1fus, max %.1fus\n", phase_names[i], count,
+		     percentile(h, count, 500) / 1000.0,
+		     percentile(h, count, 990) / 1000.0,
+		     percentile(h, count, 999) / 1000.0,
+		     __atomic_load_n(&h->max, __ATOMIC_RELAXED) / 1000.0);
+	}
+}
+
+static void *
+report_timing(void *arg)
+{
+	sigset_t *mask = arg;
+
+	while (1) {
+		int signo;
+
+		if (sigwait(mask, &signo))
+			continue;
+
+		if (signo == SIGUSR1)
+			nnio_timing_show();
+		else {
+			bool enable = !nnio_timing_enabled();
+
+			nnio_timing_enable(enable);
+			info("Timing %s\n", enable ? "enabled" : "disabled");
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Enable the timing or not, and handle SIGUSR1 to show the percentiles
+ * and SIGUSR2 to switch the timing on and off at runtime in a dedicated
+ * thread. Must be called before creating any other thread so that the
+ * signals are blocked in all of them.
+ */
+void
+nnio_timing_setup(bool enable)
+{
+	static sigset_t mask;
+
+	nnio_timing_enable(enable);
+
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGUSR1);
+	sigaddset(&mask, SIGUSR2);
+	pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+	if (nnio_thread_create(report_timing, &mask))
+		err("Failed to create the timing thread\n");
+}
@@ -25,3 +25,240 @@ nnio_util_set_verbosity(bool verbose)
 {
 	show_verbose = verbose;
 }
+
+/*
+ * The buffer is sized from FIONREAD and grows geometrically, so the number
+ * of reallocations is logarithmic in the total length. At most max bytes
+ * are read unless max is 0. Return 0 at EOF, 1 if no more data is available
+ * for now or max is reached, or -1 with errno set on failure.
+ */
+static int
+read_buf(nnio_buf_t *buf, int fd, unsigned long max)
+{
+	unsigned long left = max;
+
+	while (1) {
+		if (max && !left)
+			return 1;
+
+		int avail = 0;
+
+		if (ioctl(fd, FIONREAD, &avail) < 0 || avail <= 0)
+			avail = 1;
+
+		if (max && (unsigned long)avail > left)
+			avail = left;
+
+		if (buf->size - buf->len < (unsigned long)avail) {
+			unsigned long size = buf->size ? buf->size : PIPE_BUF;
+
+			while (size - buf->len < (unsigned long)avail)
+				size *= 2;
+
+			void *data;
+			if (buf->data)
+				data = nnio_realloc_data(buf->data, size);
+			else
+				data = nnio_alloc_data(size);
+			nnio_error_assert(data, "Failed to allocate %ld-byte buffer",
+					  size);
+
+			buf->data = data;
+			buf->size = size;
+		}
+
+		unsigned long room = buf->size - buf->len;
+		if (max && room > left)
+			room = left;
+
+		ssize_t sz = read(fd, buf->data + buf->len, room);
+		if (sz < 0) {
+			if (errno == EINTR)
+				continue;
+
+			if (errno == EAGAIN)
+				return 1;
+
+			return -1;
+		}
+
+		if (!sz)
+			return 0;
+
+		buf->len += sz;
+		left -= sz;
+	}
+}
+
+/*
+ * Read the data available on a nonblocking fd into a single buffer allocated
+ * by nnio_alloc_data(). At most NNIO_CHUNK_SIZE bytes are read per call so
+ * a writer that never pauses can't grow the buffer without bound or hold
+ * up the caller.
+ *
+ * Return 0 at EOF, 1 if more data may follow, or -1 if the read fails.
+ */
+int
+nnio_buf_read(nnio_buf_t *buf, int fd)
+{
+	int rc = read_buf(buf, fd, NNIO_CHUNK_SIZE);
+	if (rc < 0)
+		err("Failed to read fd %d (%s)\n", fd, strerror(errno));
+
+	return rc;
+}
+
+/*
+ * Read an fd not under control of the caller, e.g, the one passed by a
+ * client, up to EOF. Return -1 with errno set if the read fails or EOF is
+ * not reached, so the caller gets neither exited nor a truncated data.
+ */
+int
+nnio_buf_read_all(nnio_buf_t *buf, int fd)
+{
+	return read_buf(buf, fd, 0) ? -1 : 0;
+}
+
+/*
+ * Take the data out of the buffer, trimmed to its length so it can be
+ * passed on to nnio_socket_tx_msg(). Return NULL if the buffer is empty.
+ * The buffer is reset for reuse.
+ */
+void *
+nnio_buf_detach(nnio_buf_t *buf, unsigned int *len)
+{
+	void *data = buf->data;
+
+	*len = buf->len;
+
+	if (data && !buf->len) {
+		nnio_free_data(data);
+		data = NULL;
+	} else if (buf->len != buf->size) {
+		data = nnio_realloc_data(data, buf->len);
+		nnio_error_assert(data, "Failed to trim buffer");
+	}
+
+	buf->data = NULL;
+	buf->len = 0;
+	buf->size = 0;
+
+	return data;
+}
+
+void
+nnio_buf_release(nnio_buf_t *buf)
+{
+	if (buf->data)
+		nnio_free_data(buf->data);
+
+	buf->data = NULL;
+	buf->len = 0;
+	buf->size = 0;
+}
+
+/*
+ * Map a file read-only as the source of data to send. The kernel is advised
+ * of the sequential access so that it reads ahead aggressively. An empty
+ * file is mapped as an empty buffer.
+ */
+void *
+nnio_file_map(const char *path, unsigned long *len)
+{
+	static char empty_file[1];
+
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		err("Failed to open %s (%s)\n", path, strerror(errno));
+		return NULL;
+	}
+
+	void *addr = NULL;
+	struct stat st;
+	if (fstat(fd, &st) < 0) {
+		err("Failed to stat %s (%s)\n", path, strerror(errno));
+		goto out;
+	}
+
+	*len = st.st_size;
+	if (!*len) {
+		addr = empty_file;
+		goto out;
+	}
+
+	addr = mmap(NULL, *len, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (addr == MAP_FAILED) {
+		err("Failed to map %s (%s)\n", path, strerror(errno));
+		addr = NULL;
+		goto out;
+	}
+
+	madvise(addr, *len, MADV_SEQUENTIAL);
+
+out:
+	close(fd);
+
+	return addr;
+}
+
+void
+nnio_file_unmap(void *addr, unsigned long len)
+{
+	if (len)
+		munmap(addr, len);
+}
+
+/* Write all the data described by iov[] to fd */
+int
+nnio_write_iov(int fd, struct iovec *iov, int nr_iov)
+{
+	while (nr_iov) {
+		ssize_t sz = writev(fd, iov, nr_iov);
+		if (sz < 0) {
+			if (errno == EINTR)
+				continue;
+
+			return -1;
+		}
+
+		/* Skip over what has been written */
+		while (nr_iov && (size_t)sz >= iov->iov_len) {
+			sz -= iov->iov_len;
+			++iov;
+			--nr_iov;
+		}
+
+		if (nr_iov) {
+			iov->iov_base += sz;
+			iov->iov_len -= sz;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Create a detached thread with all signals blocked, so the signals to the
+ * process are always left to the threads of the caller, e.g, the one in
+ * sigwait(). Return -1 on failure.
+ */
+int
+nnio_thread_create(void *(*fn)(void *), void *arg)
+{
+	sigset_t all, old;
+	pthread_attr_t attr;
+	pthread_t thread;
+
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+	int rc = pthread_create(&thread, &attr, fn, arg);
+
+	pthread_attr_destroy(&attr);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	return rc ? -1 : 0;
+}
@@ -0,0 +1,360 @@
+/*
+ * nnio client agent
+ *
+ * Copyright (c) 2016, Wind River Systems, Inc.
+ * All rights reserved.
+ *
+ * See "LICENSE" for license terms.
+ *
+ * Author:
+ *	  Lans Zhang <jia.zhang@windriver.com>
+ */
+
+#include <nnio.h>
+
+/*
+ * The agent keeps the nanomsg sockets connected to each endpoint for the
+ * short-lived clients calling it through a unix socket, see agent.c. A
+ * NN_PUSH socket is shared by all calls to the same endpoint, while a
+ * NN_REQ socket is used by a call at a time because only one request is
+ * allowed in flight on it.
+ *
+ * Any client able to connect the agent may have it connect any url, so the
+ * unix socket is only accessible by the user of agent.
+ */
+
+/* The default number of calls served at the same time */
+#define NANOAGENT_CONCURRENCY	64
+
+typedef struct agent_socket agent_socket_t;
+
+struct agent_socket {
+	int protocol;
+	char *url;
+	int sock;
+	int ep;
+	bool busy;
+	agent_socket_t *next;
+};
+
+typedef struct {
+	nnio_options_t *options;
+	agent_socket_t *sockets;
+	pthread_mutex_t lock;
+	sem_t calls;		/* The calls allowed to start */
+} agent_t;
+
+typedef struct {
+	agent_t *agent;
+	int conn;
+} agent_conn_t;
+
+static void
+show_usage(const char *prog)
+{
+	info_cont("usage: %s <options> <path>\n", prog);
+	info_cont("\noptions:\n");
+	info_cont("  --help, -h: Print this help information\n");
+	info_cont("  --version, -V: Show version number\n");
+	info_cont("  --verbose, -v: Show verbose messages\n");
+	info_cont("  --quite, -q: Don't show banner information\n");
+	info_cont("  --tx-timeout, -t: Set the socket tx timeout\n");
+	info_cont("  --rx-timeout, -r: Set the socket rx timeout\n");
+	info_cont("  --linger-timeout, -l: Set the socket linger timeout\n");
+	info_cont("  --local-endpoint, -L: <path> argument is local\n");
+	info_cont("  --log-file, -g: Specify the log file\n");
+	info_cont("  --daemon, -d: Run as daemon\n");
+	info_cont("  --concurrency, -c: Serve up to <n> calls at the same "
+		  "time (%d by default)\n", NANOAGENT_CONCURRENCY);
+	info_cont("\npath:\n");
+	info_cont("  Specify the unix socket for the clients\n");
+}
+
+static agent_socket_t *
+get_socket(agent_t *agent, int protocol, const char *url)
+{
+	nnio_options_t *options = agent->options;
+	agent_socket_t *s;
+
+	pthread_mutex_lock(&agent->lock);
+
+	for (s = agent->sockets; s; s = s->next) {
+		if (s->protocol == protocol && !s->busy && !strcmp(s->url, url))
+			break;
+	}
+
+	if (s) {
+		s->busy = protocol == NN_REQ;
+		pthread_mutex_unlock(&agent->lock);
+		return s;
+	}
+
+	pthread_mutex_unlock(&agent->lock);
+
+	int sock = nnio_socket_open(protocol, options->tx_timeout,
+				    options->rx_timeout, NULL,
+				    options->linger_timeout);
+	if (sock < 0)
+		return NULL;
+
+	int ep = nnio_endpoint_add_remote(sock, url);
+	if (ep < 0) {
+		nnio_socket_close(sock);
+		return NULL;
+	}
+
+	s = calloc(1, sizeof(*s));
+	nnio_error_assert(s, "Failed to allocate socket");
+
+	s->url = strdup(url);
+	nnio_error_assert(s->url, "Failed to allocate url");
+
+	s->protocol = protocol;
+	s->sock = sock;
+	s->ep = ep;
+	s->busy = protocol == NN_REQ;
+
+	dbg("socket connected to %s\n", url);
+
+	pthread_mutex_lock(&agent->lock);
+	s->next = agent->sockets;
+	agent->sockets = s;
+	pthread_mutex_unlock(&agent->lock);
+
+	return s;
+}
+
+static void
+put_socket(agent_t *agent, agent_socket_t *s)
+{
+	pthread_mutex_lock(&agent->lock);
+	s->busy = false;
+	pthread_mutex_unlock(&agent->lock);
+}
+
+/* Drop a NN_REQ socket whose request got no reply, see nnio_socket_rx() */
+static void
+drop_socket(agent_t *agent, agent_socket_t *s)
+{
+	agent_socket_t **pp;
+
+	pthread_mutex_lock(&agent->lock);
+	for (pp = &agent->sockets; *pp != s; pp = &(*pp)->next)
+		;
+	*pp = s->next;
+	pthread_mutex_unlock(&agent->lock);
+
+	nnio_endpoint_delete(s->sock, s->ep);
+	nnio_socket_close(s->sock);
+	free(s->url);
+	free(s);
+}
+
+static int
+run_call(agent_t *agent, int protocol, const char *url, int in_fd,
+	 int out_fd)
+{
+	if (protocol != NN_PUSH && protocol != NN_REQ) {
+		err("Unsupported protocol %d\n", protocol);
+		return -1;
+	}
+
+	/* A client shouldn't be able to take down the agent */
+	nnio_buf_t in = { NULL, };
+	if (nnio_buf_read_all(&in, in_fd) < 0) {
+		err("Failed to read the payload from client (%s)\n",
+		    strerror(errno));
+		nnio_buf_release(&in);
+		return -1;
+	}
+
+	unsigned int data_len;
+	void *data = nnio_buf_detach(&in, &data_len);
+	if (!data) {
+		dbg("read client EOF\n");
+		return 0;
+	}
+
+	agent_socket_t *s = get_socket(agent, protocol, url);
+	if (!s) {
+		nnio_free_data(data);
+		return -1;
+	}
+
+	dbg("preparing to send %d-byte to %s ...\n", data_len, url);
+
+	if (nnio_socket_tx_msg(s->sock, data, data_len) < 0) {
+		err("Failed to send data to socket\n");
+		nnio_free_data(data);
+		goto err_socket;
+	}
+
+	if (protocol == NN_PUSH) {
+		put_socket(agent, s);
+		return 0;
+	}
+
+	void *rx_data;
+	unsigned int rx_data_len;
+	if (nnio_socket_rx(s->sock, &rx_data, &rx_data_len) < 0) {
+		dbg("Failed to receive data from socket\n");
+		goto err_socket;
+	}
+
+	put_socket(agent, s);
+
+	struct iovec iov = {
+		.iov_base = rx_data,
+		.iov_len = rx_data_len,
+	};
+	int rc = nnio_write_iov(out_fd, &iov, 1);
+	if (rc < 0)
+		err("Failed to write data to client\n");
+
+	nnio_free_data(rx_data);
+
+	return rc;
+
+err_socket:
+	if (protocol == NN_REQ)
+		drop_socket(agent, s);
+
+	return -1;
+}
+
+static void *
+serve_client(void *arg)
+{
+	agent_conn_t *conn = arg;
+	int protocol;
+	char *url;
+	int in_fd, out_fd;
+
+	if (!nnio_agent_receive(conn->conn, &protocol, &url, &in_fd,
+				&out_fd)) {
+		int rc = run_call(conn->agent, protocol, url, in_fd, out_fd);
+
+		nnio_agent_reply(conn->conn, rc);
+
+		close(in_fd);
+		close(out_fd);
+		free(url);
+	}
+
+	close(conn->conn);
+	sem_post(&conn->agent->calls);
+	free(conn);
+
+	return NULL;
+}
+
+static int
+open_listener(const char *path)
+{
+	struct sockaddr_un addr = {
+		.sun_family = AF_UNIX,
+	};
+
+	nnio_error_assert(strlen(path) < sizeof(addr.sun_path),
+			  "Path %s too long", path);
+	strcpy(addr.sun_path, path);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	nnio_error_assert(fd >= 0, "Unable to create unix socket");
+
+	/* Take over the socket left by the previous agent */
+	unlink(path);
+
+	int rc = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+	nnio_error_assert(!rc, "Unable to bind %s", path);
+
+	/* No client is able to connect until listen() */
+	rc = chmod(path, S_IRUSR | S_IWUSR);
+	nnio_error_assert(!rc, "Unable to change the mode of %s", path);
+
+	rc = listen(fd, SOMAXCONN);
+	nnio_error_assert(!rc, "Unable to listen on %s", path);
+
+	return fd;
+}
+
+static void
+exit_notify(void)
+{
+	if (nnio_util_verbose()) {
+		int err = nn_errno();
+
+		info("nanoagent exiting with %d (%s)\n", err,
+		     nn_strerror(err));
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	atexit(exit_notify);
+
+	nnio_options_t options = {
+		.show_usage = show_usage,
+	};
+
+	nnio_options_parse(argc, argv, &options);
+
+	if (options.daemon)
+		nnio_error_assert(!daemon(0, 1), "Failed to daemonlize");
+
+	if (!options.quite)
+		nnio_show_banner(argv[0]);
+
+	nnio_error_assert(options.local_endpoint, "-L option required");
+
+	agent_t agent = {
+		.options = &options,
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+	};
+
+	unsigned int concurrency = options.concurrency > 0 ?
+				   options.concurrency : NANOAGENT_CONCURRENCY;
+	nnio_error_assert(!sem_init(&agent.calls, 0, concurrency),
+			  "Unable to initialize semaphore");
+
+	int listener = open_listener(*options.local_endpoint);
+
+	/* The clients may exit before the reply is written */
+	nnio_error_assert(signal(SIGPIPE, SIG_IGN) != SIG_ERR,
+			  "Unable to capture SIGPIPE");
+
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+	while (1) {
+		/* The clients beyond the limit wait in the backlog */
+		while (sem_wait(&agent.calls))
+			;
+
+		int fd = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+		if (fd < 0) {
+			nnio_error_assert(errno == EINTR || errno == ECONNABORTED,
+					  "Failed to accept client");
+			sem_post(&agent.calls);
+			continue;
+		}
+
+		agent_conn_t *conn = malloc(sizeof(*conn));
+		nnio_error_assert(conn, "Failed to allocate connection");
+
+		conn->agent = &agent;
+		conn->conn = fd;
+
+		pthread_t thread;
+		if (pthread_create(&thread, &attr, serve_client, conn)) {
+			err("Failed to create the thread for client\n");
+			close(fd);
+			free(conn);
+			sem_post(&agent.calls);
+		}
+	}
+
+	return 0;
+}
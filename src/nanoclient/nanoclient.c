@@ -26,11 +26,267 @@ show_usage(const char *prog)
 	info_cont("  --linger-timeout, -l: Set the socket linger timeout\n");
 	info_cont("  --socket-name, -n: Set the socket name\n");
 	info_cont("  --remote-endpoint, -R: <url> argument is remote\n");
-	info_cont("  --exit-delay, -e: Delay to exit\n");
+	info_cont("  --local-endpoint, -L: <url> argument is local\n");
+	info_cont("  --drain-timeout, -e: Set the timeout to drain the sent data\n");
+	info_cont("  --stream, -s: Receive the result as a stream\n");
+	info_cont("  --file, -f: Send the file instead of stdin\n");
+	info_cont("  --agent, -a: Call through the nanoagent listening on the path\n");
+	info_cont("  --protocol, -p: Send as req (default) or surveyor\n");
+	info_cont("  --deadline, -D: Set the survey deadline\n");
+	info_cont("  --max-messages, -m: Set the number of respondents "
+		  "expected\n");
 	info_cont("\nurl:\n");
 	info_cont("  Specify the transport\n");
 }
 
+/*
+ * Send the request through a raw NN_REQ socket so that multiple replies,
+ * i.e, a stream, can be received for it. Each reply is written as it
+ * arrives until an empty one marking the end of stream.
+ */
+static int
+run_stream(int sock, void **data, unsigned int data_len)
+{
+	/* The request id carried by a raw NN_REQ socket has the top bit
+	 * set.
+	 */
+	srandom(getpid() ^ time(NULL));
+	uint32_t id = htonl(0x80000000 | (uint32_t)random());
+	void *header = nnio_socket_header(&id, sizeof(id));
+
+	dbg("preparing to send %d-byte to socket ...\n", data_len);
+
+	int rc = nnio_socket_tx_raw(sock, *data, data_len, header);
+	if (rc < 0) {
+		err("Failed to send data to socket\n");
+		nnio_free_data(header);
+		return -1;
+	}
+
+	/* The ownership of data is passed to nanomsg */
+	*data = NULL;
+
+	unsigned long total_rx_len = 0;
+
+	while (1) {
+		void *rx_data;
+		unsigned int rx_data_len;
+
+		rc = nnio_socket_rx_raw(sock, &rx_data, &rx_data_len, &header,
+					0);
+		if (rc < 0) {
+			dbg("Failed to receive data from socket\n");
+			return -1;
+		}
+
+		nnio_free_data(header);
+
+		if (!rx_data_len) {
+			if (nnio_util_verbose())
+				info("read socket EOF\n");
+
+			nnio_free_data(rx_data);
+			break;
+		}
+
+		dbg("reading %d-byte from socket ... \n", rx_data_len);
+
+		fwrite(rx_data, 1, rx_data_len, stdout);
+		fflush(stdout);
+
+		total_rx_len += rx_data_len;
+		nnio_free_data(rx_data);
+	}
+
+	if (nnio_util_verbose())
+		info("Total rx length: %ld-byte\n", total_rx_len);
+
+	return 0;
+}
+
+/*
+ * Send the request from the mapping of file. nanomsg copies the request from
+ * the page cache directly, so it never goes through a user buffer. In stream
+ * mode, the raw socket requires a message allocated by nanomsg, so the
+ * request is copied into a message returned in data instead of being sent.
+ *
+ * Return the length of request, or -1 on error.
+ */
+static ssize_t
+send_file(int sock, const char *path, void **data)
+{
+	unsigned long len;
+	void *addr = nnio_file_map(path, &len);
+	if (!addr)
+		return -1;
+
+	/* A message is limited to unsigned int length */
+	if (len > UINT_MAX) {
+		err("File %s exceeds %u-byte for a request\n", path, UINT_MAX);
+		nnio_file_unmap(addr, len);
+		return -1;
+	}
+
+	ssize_t rc = len;
+
+	if (!len) {
+		if (nnio_util_verbose())
+			dbg("file %s is empty\n", path);
+	} else if (data) {
+		*data = nnio_alloc_data(len);
+		nnio_error_assert(*data, "Failed to allocate memory");
+
+		memcpy(*data, addr, len);
+	} else {
+		dbg("preparing to send %ld-byte to socket ...\n", len);
+
+		if (nnio_socket_tx(sock, addr, len) < 0) {
+			err("Failed to send data to socket\n");
+			rc = -1;
+		}
+	}
+
+	nnio_file_unmap(addr, len);
+
+	return rc;
+}
+
+static int
+compare_latency(const void *a, const void *b)
+{
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* The nearest-rank percentile in per mille */
+static double
+percentile(const double *sorted, unsigned long nr, unsigned int permille)
+{
+	unsigned long rank = (nr * permille + 999) / 1000;
+
+	return sorted[rank ? rank - 1 : 0];
+}
+
+static void
+show_summary(double *latencies, unsigned long nr_replies,
+	     unsigned long expected)
+{
+	if (expected)
+		info("%ld respondents replied, %ld stragglers\n", nr_replies,
+		     expected > nr_replies ? expected - nr_replies : 0);
+	else
+		info("%ld respondents replied\n", nr_replies);
+
+	if (!nr_replies)
+		return;
+
+	qsort(latencies, nr_replies, sizeof(*latencies), compare_latency);
+
+	info("latency min/p50/p90/p99/max: %.1f/%.1f/%.1f/%.1f/%.1f ms\n",
+	     latencies[0], percentile(latencies, nr_replies, 500),
+	     percentile(latencies, nr_replies, 900),
+	     percentile(latencies, nr_replies, 990),
+	     latencies[nr_replies - 1]);
+}
+
+/*
+ * Broadcast the request to all respondents through a NN_SURVEYOR socket,
+ * and write each reply as it arrives until the survey deadline expires or
+ * all respondents expected have replied. Each reply starts with the name
+ * of respondent terminated by a NUL, which is shown in the banner of its
+ * output.
+ */
+static int
+run_survey(int sock, void **data, unsigned int data_len,
+	   unsigned long expected, bool quite)
+{
+	struct timespec start;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	dbg("preparing to send %d-byte survey to socket ...\n", data_len);
+
+	if (nnio_socket_tx_msg(sock, *data, data_len) < 0) {
+		err("Failed to send data to socket\n");
+		return -1;
+	}
+
+	/* The ownership of data is passed to nanomsg */
+	*data = NULL;
+
+	double *latencies = NULL;
+	unsigned long nr_replies = 0;
+	int rc = 0;
+
+	while (!expected || nr_replies < expected) {
+		void *rx_data;
+		unsigned int rx_data_len;
+
+		/* Fail with ETIMEDOUT once the deadline expires */
+		if (nnio_socket_rx(sock, &rx_data, &rx_data_len) < 0)
+			break;
+
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+
+		double latency = (now.tv_sec - start.tv_sec) * 1e3 +
+				 (now.tv_nsec - start.tv_nsec) / 1e6;
+
+		latencies = realloc(latencies, (nr_replies + 1) *
+					       sizeof(*latencies));
+		nnio_error_assert(latencies, "Failed to allocate latencies");
+		latencies[nr_replies++] = latency;
+
+		const char *name = rx_data;
+		unsigned int name_len = strnlen(name, rx_data_len);
+		unsigned int off = name_len + 1;
+
+		/* Not replied by nanoserver */
+		if (name_len == rx_data_len) {
+			name = "unknown";
+			name_len = strlen(name);
+			off = 0;
+		}
+
+		char banner[HOST_NAME_MAX + 64];
+		int banner_len = snprintf(banner, sizeof(banner),
+					  "==> %.*s (%.1f ms) <==\n",
+					  name_len > HOST_NAME_MAX ?
+					  HOST_NAME_MAX : name_len, name,
+					  latency);
+
+		struct iovec iov[] = {
+			{
+				.iov_base = banner,
+				.iov_len = banner_len,
+			},
+			{
+				.iov_base = rx_data + off,
+				.iov_len = rx_data_len - off,
+			},
+		};
+
+		if (nnio_write_iov(STDOUT_FILENO, iov, 2) < 0) {
+			err("Failed to write data to stdout\n");
+			rc = -1;
+		}
+
+		nnio_free_data(rx_data);
+
+		if (rc < 0)
+			break;
+	}
+
+	if (!quite)
+		show_summary(latencies, nr_replies, expected);
+
+	free(latencies);
+
+	return rc;
+}
+
 static void
 exit_notify(void)
 {
@@ -56,57 +312,131 @@ main(int argc, char **argv)
 	if (!options.quite)
 		nnio_show_banner(argv[0]);
 
-	int sock = nnio_socket_open(NN_REQ, options.tx_timeout,
-				    options.rx_timeout, options.socket_name,
-				    options.linger_timeout);
+	bool survey = options.protocol == NN_SURVEYOR;
+	if (options.protocol != -1 && options.protocol != NN_REQ && !survey)
+		die("--protocol only accepts req or surveyor\n");
+
+	if (survey && options.stream)
+		die("--stream can't be used with surveyor\n");
+
+	if (options.agent) {
+		if (survey || options.stream)
+			die("--agent only works with a single req\n");
+
+		nnio_error_assert(options.remote_endpoint, "-R option required");
+
+		/* The agent reads the payload and writes the reply */
+		return nnio_agent_call_file(options.agent, NN_REQ,
+					    *options.remote_endpoint,
+					    options.file);
+	}
+
+	int sock;
+	if (survey) {
+		sock = nnio_socket_open(NN_SURVEYOR, options.tx_timeout,
+					options.rx_timeout,
+					options.socket_name,
+					options.linger_timeout);
+		if (sock >= 0)
+			nnio_socket_set_deadline(sock, options.deadline);
+	} else if (options.stream)
+		sock = nnio_socket_open_raw(NN_REQ, options.tx_timeout,
+					    options.rx_timeout,
+					    options.socket_name,
+					    options.linger_timeout);
+	else
+		sock = nnio_socket_open(NN_REQ, options.tx_timeout,
+					options.rx_timeout,
+					options.socket_name,
+					options.linger_timeout);
 	if (sock < 0)
 		return -1;
 
-	nnio_error_assert(options.remote_endpoint, "-R option required");
-
+	/* A surveyor usually binds for the respondents to connect */
 	int rc;
-	int ep = nnio_endpoint_add_remote(sock, *options.remote_endpoint);
+	int ep;
+	if (options.local_endpoint)
+		ep = nnio_endpoint_add_local(sock, *options.local_endpoint);
+	else
+		ep = nnio_endpoint_add_remote(sock, *options.remote_endpoint);
 	if (ep < 0) {
 		rc = -1;
 		goto err_add_endpoint;
 	}
 
-	unsigned int data_len;
-	size_t sz = sizeof(data_len);
-	rc = nn_getsockopt(sock, NN_SOL_SOCKET, NN_RCVMAXSIZE, &data_len, &sz);
-	nnio_error_assert(!rc, "Failed to get NN_RCVMAXSIZE");
-
-	void *data = malloc(data_len);
-	nnio_error_assert(data, "Failed to allocate memory");
+	void *data = NULL;
+	ssize_t len;
+
+	if (options.file) {
+		len = send_file(sock, options.file,
+				options.stream || survey ? &data : NULL);
+		if (len < 0) {
+			rc = -1;
+			goto err_read;
+		}
+
+		if (!len)
+			goto err_read;
+
+		if (!data)
+			goto rx_result;
+	} else {
+		unsigned int data_len;
+		size_t sz = sizeof(data_len);
+		rc = nn_getsockopt(sock, NN_SOL_SOCKET, NN_RCVMAXSIZE,
+				   &data_len, &sz);
+		nnio_error_assert(!rc, "Failed to get NN_RCVMAXSIZE");
+
+		data = nnio_alloc_data(data_len);
+		nnio_error_assert(data, "Failed to allocate memory");
+
+		len = read(STDIN_FILENO, data, data_len);
+		if (len < 0) {
+			err("Failed to read data from stdin\n");
+			rc = -1;
+			goto err_read;
+		}
+
+		dbg("reading %ld-byte from stdin ...\n", len);
+
+		if (!len) {
+			if (nnio_util_verbose())
+				dbg("read stdin EOF\n");
+
+			goto err_read;
+		}
+
+		/* nanomsg sends the whole buffer on zero-copy */
+		if (len != data_len) {
+			data = nnio_realloc_data(data, len);
+			nnio_error_assert(data, "Failed to trim memory");
+		}
+	}
 
-	ssize_t len = read(STDIN_FILENO, data, data_len);
-	if (len < 0) {
-		err("Failed to read data from stdin\n");
-		rc = -1;
+	if (options.stream) {
+		rc = run_stream(sock, &data, len);
 		goto err_read;
 	}
 
-	dbg("reading %ld-byte from stdin ...\n", len);
-
-	if (!len) {
-		if (nnio_util_verbose())
-			dbg("read stdin EOF\n");
-
+	if (survey) {
+		rc = run_survey(sock, &data, len, options.max_messages,
+				options.quite);
 		goto err_read;
 	}
 
 	dbg("preparing to send %d-byte to socket ...\n", (int)len);
 
-	len = nnio_socket_tx(sock, data, len);
+	len = nnio_socket_tx_msg(sock, data, len);
 	if (len < 0) {
-		err("Failed to send %ld-byte data to socket\n", len);
+		err("Failed to send data to socket\n");
 		rc = -1;
 		goto err_read;
 	}
 
-	free(data);
+	/* The ownership of data is passed to nanomsg */
 	data = NULL;
 
+rx_result:
 	if (nnio_util_verbose())
 		info("Total tx length: %ld-byte\n", len);
 
@@ -138,15 +468,15 @@ err_eof:
 	nnio_free_data(rx_data);
 
 err_read:
-	free(data);
+	if (data)
+		nnio_free_data(data);
 
 	/* If the tx socket is closed before the sent data received, the rx
 	 * socket would be blocked forever. Essentially speaking, this is
 	 * caused by the lack of the support for the linger timeout in
 	 * nanomsg.
 	 */
-	if (options.exit_delay)
-		usleep(options.exit_delay);
+	nnio_socket_drain(sock, options.drain_timeout);
 
 	dbg("closing socket ...\n");
 
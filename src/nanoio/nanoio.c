@@ -0,0 +1,497 @@
+/*
+ * nnio generic tool
+ *
+ * Copyright (c) 2016, Wind River Systems, Inc.
+ * All rights reserved.
+ *
+ * See "LICENSE" for license terms.
+ *
+ * Author:
+ *	  Lans Zhang <jia.zhang@windriver.com>
+ */
+
+#include <nnio.h>
+
+/* The max number of messages received at once */
+#define NANOIO_BATCH			64
+
+/* The max length of a message read from stdin */
+#define NANOIO_LINE_MAX			(64 * 1024)
+
+static void
+show_usage(const char *prog)
+{
+	info_cont("usage: %s <options> <url>\n", prog);
+	info_cont("\noptions:\n");
+	info_cont("  --help, -h: Print this help information\n");
+	info_cont("  --version, -V: Show version number\n");
+	info_cont("  --verbose, -v: Show verbose messages\n");
+	info_cont("  --quite, -q: Don't show banner information\n");
+	info_cont("  --protocol, -p: Set the scalability protocol\n");
+	info_cont("  --tx-timeout, -t: Set the socket tx timeout\n");
+	info_cont("  --rx-timeout, -r: Set the socket rx timeout\n");
+	info_cont("  --linger-timeout, -l: Set the socket linger timeout\n");
+	info_cont("  --socket-name, -n: Set the socket name\n");
+	info_cont("  --local-endpoint, -L: <url> argument is local\n");
+	info_cont("  --remote-endpoint, -R: <url> argument is remote\n");
+	info_cont("  --drain-timeout, -e: Set the timeout to drain the sent data\n");
+	info_cont("  --exec, -E: Reply with the output of the executable\n");
+	info_cont("  --subscribe, -S: Subscribe the topic for sub\n");
+	info_cont("  --deadline, -D: Set the survey deadline for surveyor\n");
+	info_cont("\nprotocol:\n");
+	info_cont("  push, pub: Send each line of stdin as a message\n");
+	info_cont("  pull, sub: Write the received messages to stdout\n");
+	info_cont("  req: Send each line of stdin and write the reply\n");
+	info_cont("  surveyor: Send each line of stdin and write the responses\n");
+	info_cont("  rep, respondent: Reply with -E or echo the requests\n");
+	info_cont("  bus, pair: Send stdin and write the received messages\n");
+	info_cont("\nurl:\n");
+	info_cont("  Specify the transport\n");
+}
+
+/*
+ * stdin is split into messages at each new line, which is kept in the
+ * message so that the receiver is able to write the messages as is. A line
+ * longer than NANOIO_LINE_MAX is split into several messages.
+ */
+typedef struct {
+	char buf[NANOIO_LINE_MAX];
+	unsigned int len;
+} line_reader_t;
+
+typedef int (*line_handler_t)(int sock, void *line, unsigned int len);
+
+/*
+ * Read stdin once and pass each complete line to the handler. Return 0 at
+ * EOF, 1 if more lines are expected, or -1 on error.
+ */
+static int
+read_lines(line_reader_t *reader, int sock, line_handler_t handler)
+{
+	ssize_t sz;
+
+	do {
+		sz = read(STDIN_FILENO, reader->buf + reader->len,
+			  sizeof(reader->buf) - reader->len);
+	} while (sz < 0 && errno == EINTR);
+
+	if (sz < 0) {
+		if (errno == EAGAIN)
+			return 1;
+
+		err("Failed to read data from stdin\n");
+		return -1;
+	}
+
+	if (!sz) {
+		if (nnio_util_verbose())
+			info("read stdin EOF\n");
+
+		/* The last line without a new line */
+		if (reader->len && handler(sock, reader->buf, reader->len) < 0)
+			return -1;
+
+		reader->len = 0;
+
+		return 0;
+	}
+
+	char *line = reader->buf;
+	unsigned int len = reader->len + sz;
+
+	while (len) {
+		char *eol = memchr(line, '\n', len);
+		if (!eol)
+			break;
+
+		unsigned int line_len = eol - line + 1;
+		if (handler(sock, line, line_len) < 0)
+			return -1;
+
+		line += line_len;
+		len -= line_len;
+	}
+
+	/* The buffer is filled up by a single line */
+	if (len == sizeof(reader->buf)) {
+		if (handler(sock, line, len) < 0)
+			return -1;
+
+		len = 0;
+	}
+
+	memmove(reader->buf, line, len);
+	reader->len = len;
+
+	return 1;
+}
+
+static int
+send_input(int sock, line_handler_t handler)
+{
+	line_reader_t *reader = calloc(1, sizeof(*reader));
+	nnio_error_assert(reader, "Failed to allocate line reader");
+
+	int rc;
+
+	do {
+		rc = read_lines(reader, sock, handler);
+	} while (rc > 0);
+
+	free(reader);
+
+	return rc;
+}
+
+/* Write the received messages to stdout and free them */
+static int
+write_msgs(nnio_msg_t *msgs, int nr_msgs)
+{
+	struct iovec iov[NANOIO_BATCH];
+
+	for (int i = 0; i < nr_msgs; ++i) {
+		iov[i].iov_base = msgs[i].data;
+		iov[i].iov_len = msgs[i].data_len;
+	}
+
+	dbg("writing %d messages to stdout ...\n", nr_msgs);
+
+	int rc = nnio_write_iov(STDOUT_FILENO, iov, nr_msgs);
+	if (rc < 0)
+		err("Failed to write data to stdout\n");
+
+	for (int i = 0; i < nr_msgs; ++i)
+		nnio_free_data(msgs[i].data);
+
+	return rc;
+}
+
+static int
+send_line(int sock, void *line, unsigned int len)
+{
+	dbg("preparing to send %d-byte to socket ...\n", len);
+
+	if (nnio_socket_tx(sock, line, len) < 0) {
+		err("Failed to send data to socket\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int
+request_line(int sock, void *line, unsigned int len)
+{
+	if (send_line(sock, line, len) < 0)
+		return -1;
+
+	nnio_msg_t msg;
+
+	dbg("preparing to receive the reply from socket ...\n");
+
+	if (nnio_socket_rx(sock, &msg.data, &msg.data_len) < 0) {
+		err("Failed to receive the reply from socket\n");
+		return -1;
+	}
+
+	return write_msgs(&msg, 1);
+}
+
+/* Collect the responses to the survey until the deadline */
+static int
+survey_line(int sock, void *line, unsigned int len)
+{
+	if (send_line(sock, line, len) < 0)
+		return -1;
+
+	unsigned int nr_responses = 0;
+	nnio_msg_t msg;
+
+	while (nnio_socket_rx(sock, &msg.data, &msg.data_len) >= 0) {
+		if (write_msgs(&msg, 1) < 0)
+			return -1;
+
+		++nr_responses;
+	}
+
+	dbg("%d responses received for the survey\n", nr_responses);
+
+	return 0;
+}
+
+/* Receive until the rx timeout */
+static int
+receive_msgs(int sock)
+{
+	nnio_msg_t msgs[NANOIO_BATCH];
+
+	while (1) {
+		dbg("preparing to receive data from socket ...\n");
+
+		int nr_msgs = nnio_socket_rx_batch(sock, msgs, NANOIO_BATCH);
+		if (nr_msgs < 0)
+			break;
+
+		if (write_msgs(msgs, nr_msgs) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+/* Reply each request until the rx timeout */
+static int
+reply_requests(int sock, const char *exec)
+{
+	if (exec)
+		nnio_spawn_prepare(exec);
+
+	while (1) {
+		void *data;
+		unsigned int data_len;
+
+		dbg("preparing to receive the request from socket ...\n");
+
+		if (nnio_socket_rx(sock, &data, &data_len) < 0)
+			break;
+
+		if (exec) {
+			nnio_spawn(sock, exec, data, data_len);
+			nnio_free_data(data);
+			continue;
+		}
+
+		dbg("preparing to send %d-byte to socket ...\n", data_len);
+
+		if (nnio_socket_tx_msg(sock, data, data_len) < 0) {
+			err("Failed to send %d-byte data to socket\n",
+			    data_len);
+			nnio_free_data(data);
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Full duplex mode for bus and pair
+ *
+ * stdin and the socket are watched at the same time. After stdin EOF, the
+ * messages are still received until no message arrives for the rx timeout,
+ * or until SIGINT or SIGTERM without the rx timeout.
+ */
+
+typedef struct {
+	int sock;
+	int rx_timeout;
+	bool rx_seen;
+	line_reader_t *reader;
+} duplex_t;
+
+static int
+duplex_idle(nnio_loop_t *loop, nnio_loop_source_t *src, int fd,
+	    unsigned int events, void *priv)
+{
+	duplex_t *duplex = priv;
+
+	if (!duplex->rx_seen)
+		nnio_loop_stop(loop, 0);
+
+	duplex->rx_seen = false;
+
+	return 0;
+}
+
+static void
+duplex_eof(nnio_loop_t *loop, duplex_t *duplex)
+{
+	if (duplex->rx_timeout >= 0)
+		nnio_loop_add_timer(loop, duplex->rx_timeout, duplex_idle,
+				    duplex);
+}
+
+static int
+duplex_tx(nnio_loop_t *loop, nnio_loop_source_t *src, int fd,
+	  unsigned int events, void *priv)
+{
+	duplex_t *duplex = priv;
+
+	int rc = read_lines(duplex->reader, duplex->sock, send_line);
+	if (rc < 0)
+		return rc;
+
+	if (!rc) {
+		nnio_loop_remove(src);
+		duplex_eof(loop, duplex);
+	}
+
+	return 0;
+}
+
+static int
+duplex_rx(nnio_loop_t *loop, nnio_loop_source_t *src, int sock,
+	  unsigned int events, void *priv)
+{
+	duplex_t *duplex = priv;
+	nnio_msg_t msgs[NANOIO_BATCH];
+
+	int nr_msgs = nnio_socket_rx_batch(sock, msgs, NANOIO_BATCH);
+	if (nr_msgs < 0)
+		return 0;
+
+	duplex->rx_seen = true;
+
+	return write_msgs(msgs, nr_msgs);
+}
+
+static int
+duplex_stop(nnio_loop_t *loop, nnio_loop_source_t *src, int signo,
+	    unsigned int events, void *priv)
+{
+	dbg("signal %d received\n", signo);
+
+	nnio_loop_stop(loop, 0);
+
+	return 0;
+}
+
+static int
+run_duplex(int sock, int rx_timeout)
+{
+	duplex_t duplex = {
+		.sock = sock,
+		.rx_timeout = rx_timeout,
+	};
+	int rc;
+
+	duplex.reader = calloc(1, sizeof(*duplex.reader));
+	nnio_error_assert(duplex.reader, "Failed to allocate line reader");
+
+	nnio_loop_t *loop = nnio_loop_create();
+
+	nnio_loop_add_signal(loop, SIGINT, duplex_stop, NULL);
+	nnio_loop_add_signal(loop, SIGTERM, duplex_stop, NULL);
+	nnio_loop_add_socket(loop, sock, NNIO_LOOP_IN, duplex_rx, &duplex);
+
+	/* A regular file is always readable and can't be watched by epoll */
+	struct stat st;
+	if (!fstat(STDIN_FILENO, &st) && S_ISREG(st.st_mode)) {
+		do {
+			rc = read_lines(duplex.reader, sock, send_line);
+		} while (rc > 0);
+
+		if (rc < 0)
+			goto out;
+
+		duplex_eof(loop, &duplex);
+	} else
+		nnio_loop_add_fd(loop, STDIN_FILENO, NNIO_LOOP_IN, duplex_tx,
+				 &duplex);
+
+	rc = nnio_loop_run(loop);
+
+out:
+	nnio_loop_destroy(loop);
+	free(duplex.reader);
+
+	return rc;
+}
+
+static void
+exit_notify(void)
+{
+	if (nnio_util_verbose()) {
+		int err = nn_errno();
+
+		info("nanoio exiting with %d (%s)\n", err,
+		     nn_strerror(err));
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	atexit(exit_notify);
+
+	nnio_options_t options = {
+		.show_usage = show_usage,
+	};
+
+	nnio_options_parse(argc, argv, &options);
+
+	if (!options.quite)
+		nnio_show_banner(argv[0]);
+
+	nnio_error_assert(options.protocol != -1, "-p option required");
+
+	int sock = nnio_socket_open(options.protocol, options.tx_timeout,
+				    options.rx_timeout, options.socket_name,
+				    options.linger_timeout);
+	if (sock < 0)
+		return -1;
+
+	int rc;
+	int ep;
+	if (options.local_endpoint)
+		ep = nnio_endpoint_add_local(sock, *options.local_endpoint);
+	else
+		ep = nnio_endpoint_add_remote(sock, *options.remote_endpoint);
+	if (ep < 0) {
+		rc = -1;
+		goto err_add_endpoint;
+	}
+
+	switch (options.protocol) {
+	case NN_PUSH:
+	case NN_PUB:
+		rc = send_input(sock, send_line);
+		break;
+	case NN_SUB:
+		/* Receive everything by default */
+		if (!options.nr_topics)
+			nnio_socket_subscribe(sock, "");
+
+		for (unsigned int i = 0; i < options.nr_topics; ++i)
+			nnio_socket_subscribe(sock, options.topics[i]);
+		/* Fall through */
+	case NN_PULL:
+		rc = receive_msgs(sock);
+		break;
+	case NN_REQ:
+		rc = send_input(sock, request_line);
+		break;
+	case NN_SURVEYOR:
+		nnio_socket_set_deadline(sock, options.deadline);
+		rc = send_input(sock, survey_line);
+		break;
+	case NN_REP:
+	case NN_RESPONDENT:
+		rc = reply_requests(sock, options.exec);
+		break;
+	case NN_BUS:
+	case NN_PAIR:
+		rc = run_duplex(sock, options.rx_timeout);
+		break;
+	default:
+		rc = -1;
+		break;
+	}
+
+	/* If the tx socket is closed before the sent data received, the rx
+	 * socket would be blocked forever. Essentially speaking, this is
+	 * caused by the lack of the support for the linger timeout in
+	 * nanomsg.
+	 */
+	nnio_socket_drain(sock, options.drain_timeout);
+
+	dbg("closing socket ...\n");
+
+	nnio_endpoint_delete(sock, ep);
+
+err_add_endpoint:
+	nnio_socket_close(sock);
+
+	free(options.topics);
+
+	return rc;
+}
@@ -0,0 +1,231 @@
+/*
+ * nnio proxy
+ *
+ * Copyright (c) 2016, Wind River Systems, Inc.
+ * All rights reserved.
+ *
+ * See "LICENSE" for license terms.
+ *
+ * Author:
+ *	  Lans Zhang <jia.zhang@windriver.com>
+ */
+
+#include <nnio.h>
+
+/*
+ * The proxy binds a front-end and a back-end raw socket, and forwards the
+ * messages between them along with their protocol headers, in the same way
+ * as nn_device(). Each direction is forwarded by its own thread so that the
+ * messages and bytes are able to be counted per direction.
+ */
+
+/* How often the forwarding threads check for exiting, in millisecond */
+#define NANOPROXY_POLL_INTERVAL		200
+
+typedef struct {
+	const char *name;
+	nnio_forward_t fwd;
+	pthread_t thread;
+} direction_t;
+
+static bool exiting;
+
+static void
+show_usage(const char *prog)
+{
+	info_cont("usage: %s <options> <url>\n", prog);
+	info_cont("\noptions:\n");
+	info_cont("  --help, -h: Print this help information\n");
+	info_cont("  --version, -V: Show version number\n");
+	info_cont("  --verbose, -v: Show verbose messages\n");
+	info_cont("  --quite, -q: Don't show banner information\n");
+	info_cont("  --protocol, -p: Set the protocol (req, push or pub)\n");
+	info_cont("  --socket-name, -n: Set the socket name\n");
+	info_cont("  --local-endpoint, -L: <url> argument is local\n");
+	info_cont("  --back-end, -b: Set the back-end url\n");
+	info_cont("\nurl:\n");
+	info_cont("  Specify the front-end transport\n");
+	info_cont("\nsignals:\n");
+	info_cont("  SIGUSR1: Show the statistics\n");
+}
+
+static void *
+forward(void *arg)
+{
+	direction_t *dir = arg;
+
+	nnio_forward(&dir->fwd);
+
+	return NULL;
+}
+
+static void
+show_stats(direction_t *dirs, unsigned int nr_dirs)
+{
+	for (unsigned int i = 0; i < nr_dirs; ++i) {
+		nnio_forward_t *fwd = &dirs[i].fwd;
+
+		info("%s: %ld messages, %ld-byte\n", dirs[i].name,
+		     __atomic_load_n(&fwd->nr_msgs, __ATOMIC_RELAXED),
+		     __atomic_load_n(&fwd->nr_bytes, __ATOMIC_RELAXED));
+	}
+}
+
+/* Return the protocol of front-end and the peer protocol of back-end */
+static int
+check_protocol(int protocol, int *back)
+{
+	switch (protocol) {
+	case NN_REQ:
+	case NN_REP:
+		*back = NN_REQ;
+		return NN_REP;
+	case NN_PUSH:
+	case NN_PULL:
+		*back = NN_PUSH;
+		return NN_PULL;
+	case NN_PUB:
+	case NN_SUB:
+		*back = NN_PUB;
+		return NN_SUB;
+	default:
+		break;
+	}
+
+	return -1;
+}
+
+static int
+open_socket(int protocol, const char *url, const char *socket_name)
+{
+	int sock = nnio_socket_open_raw(protocol, NANOPROXY_POLL_INTERVAL,
+					NANOPROXY_POLL_INTERVAL, socket_name,
+					-1);
+	if (sock < 0)
+		return -1;
+
+	if (nnio_endpoint_add_local(sock, url) < 0) {
+		nnio_socket_close(sock);
+		return -1;
+	}
+
+	return sock;
+}
+
+static void
+exit_notify(void)
+{
+	if (nnio_util_verbose()) {
+		int err = nn_errno();
+
+		info("nanoproxy exiting with %d (%s)\n", err,
+		     nn_strerror(err));
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	atexit(exit_notify);
+
+	nnio_options_t options = {
+		.show_usage = show_usage,
+	};
+
+	nnio_options_parse(argc, argv, &options);
+
+	if (!options.quite)
+		nnio_show_banner(argv[0]);
+
+	nnio_error_assert(options.local_endpoint, "-L option required");
+	nnio_error_assert(options.back_url, "-b option required");
+
+	int back_protocol;
+	int front_protocol = check_protocol(options.protocol, &back_protocol);
+	nnio_error_assert(front_protocol != -1,
+			  "-p option with req, push or pub required");
+
+	int rc = -1;
+	int front = open_socket(front_protocol, *options.local_endpoint,
+				options.socket_name);
+	if (front < 0)
+		return -1;
+
+	int back = open_socket(back_protocol, options.back_url, NULL);
+	if (back < 0)
+		goto err_back;
+
+	/* Forward all messages regardless of the topic */
+	if (front_protocol == NN_SUB)
+		nnio_socket_subscribe(front, "");
+
+	direction_t dirs[] = {
+		{
+			.name = "front-end -> back-end",
+			.fwd = {
+				.rx_sock = front,
+				.tx_sock = back,
+				.exiting = &exiting,
+			},
+		},
+		{
+			.name = "back-end -> front-end",
+			.fwd = {
+				.rx_sock = back,
+				.tx_sock = front,
+				.exiting = &exiting,
+			},
+		},
+	};
+	/* Only the replies are forwarded backwards */
+	unsigned int nr_dirs = front_protocol == NN_REP ? 2 : 1;
+
+	/* The signals are handled by the main thread only */
+	sigset_t mask;
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+	sigaddset(&mask, SIGUSR1);
+	pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+	unsigned int nr_threads;
+	for (nr_threads = 0; nr_threads < nr_dirs; ++nr_threads) {
+		rc = pthread_create(&dirs[nr_threads].thread, NULL, forward,
+				    dirs + nr_threads);
+		if (rc) {
+			err("Failed to create the forwarding thread\n");
+			rc = -1;
+			goto err_thread;
+		}
+	}
+
+	while (1) {
+		int signo;
+
+		if (sigwait(&mask, &signo))
+			continue;
+
+		if (signo != SIGUSR1)
+			break;
+
+		show_stats(dirs, nr_dirs);
+	}
+
+	rc = 0;
+
+err_thread:
+	__atomic_store_n(&exiting, true, __ATOMIC_RELAXED);
+
+	while (nr_threads--)
+		pthread_join(dirs[nr_threads].thread, NULL);
+
+	if (!options.quite)
+		show_stats(dirs, nr_dirs);
+
+	nnio_socket_close(back);
+
+err_back:
+	nnio_socket_close(front);
+
+	return rc;
+}
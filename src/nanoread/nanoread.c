@@ -24,6 +24,9 @@ show_usage(const char *prog)
 	info_cont("  --rx-timeout, -r: Set the socket rx timeout\n");
 	info_cont("  --socket-name, -n: Set the socket name\n");
 	info_cont("  --local-endpoint, -L: <url> argument is local\n");
+	info_cont("  --stream, -s: Receive until the end of stream\n");
+	info_cont("  --max-messages, -m: Receive up to the number of messages\n");
+	info_cont("  --chunked, -C: Receive a chunked transfer\n");
 	info_cont("\nurl:\n");
 	info_cont("  Specify the transport\n");
 }
@@ -39,6 +42,164 @@ exit_notify(void)
 	}
 }
 
+/* The max number of messages written to stdout at once */
+#define NANOREAD_BATCH			64
+
+static int
+run_once(int sock)
+{
+	void *data;
+	unsigned int data_len;
+
+	dbg("preparing to receive data from socket ...\n");
+
+	int rc = nnio_socket_rx(sock, &data, &data_len);
+	if (rc < 0) {
+		dbg("Failed to receive data from socket\n");
+		return rc;
+	}
+
+	if (!data_len) {
+		if (nnio_util_verbose())
+			info("read socket EOF\n");
+
+		nnio_free_data(data);
+		return 0;
+	}
+
+	dbg("reading %d-byte from socket ... \n", data_len);
+
+	/* The data is not necessarily a string */
+	struct iovec iov = {
+		.iov_base = data,
+		.iov_len = data_len,
+	};
+
+	rc = nnio_write_iov(STDOUT_FILENO, &iov, 1);
+	if (rc < 0)
+		err("Failed to write %d-byte data to stdout\n", data_len);
+
+	nnio_free_data(data);
+
+	if (nnio_util_verbose())
+		info("Total rx length: %d-byte\n", data_len);
+
+	return rc;
+}
+
+/*
+ * Keep receiving until an empty message marking the end of stream, the
+ * max number of messages, or the rx timeout which serves as the idle
+ * timeout. The messages queued in the socket are received in batch and
+ * written to stdout with a single writev().
+ */
+static int
+run_continuous(int sock, unsigned long max_messages, bool quite)
+{
+	nnio_msg_t msgs[NANOREAD_BATCH];
+	struct iovec iov[NANOREAD_BATCH];
+	unsigned long nr_rx = 0;
+	unsigned long total_rx_len = 0;
+	struct timespec start, end;
+	bool eos = false;
+	int rc = 0;
+
+	while (!eos && (!max_messages || nr_rx < max_messages)) {
+		unsigned int nr_msgs = NANOREAD_BATCH;
+
+		if (max_messages && max_messages - nr_rx < nr_msgs)
+			nr_msgs = max_messages - nr_rx;
+
+		dbg("preparing to receive data from socket ...\n");
+
+		int nr_batch = nnio_socket_rx_batch(sock, msgs, nr_msgs);
+		if (nr_batch < 0) {
+			if (nn_errno() == ETIMEDOUT) {
+				if (nnio_util_verbose())
+					info("read socket idle timeout\n");
+				break;
+			}
+
+			err("Failed to receive data from socket\n");
+			rc = -1;
+			break;
+		}
+
+		if (!nr_rx)
+			clock_gettime(CLOCK_MONOTONIC, &start);
+
+		/* Anything following the end of stream in the same batch
+		 * is dropped.
+		 */
+		int nr_iov = 0;
+		for (int i = 0; i < nr_batch; ++i) {
+			if (!msgs[i].data_len) {
+				if (nnio_util_verbose())
+					info("read socket EOF\n");
+
+				eos = true;
+				break;
+			}
+
+			iov[nr_iov].iov_base = msgs[i].data;
+			iov[nr_iov++].iov_len = msgs[i].data_len;
+			total_rx_len += msgs[i].data_len;
+			++nr_rx;
+		}
+
+		dbg("writing %d messages to stdout ...\n", nr_iov);
+
+		if (nnio_write_iov(STDOUT_FILENO, iov, nr_iov) < 0) {
+			err("Failed to write data to stdout\n");
+			rc = -1;
+		}
+
+		for (int i = 0; i < nr_batch; ++i)
+			nnio_free_data(msgs[i].data);
+
+		if (rc < 0)
+			break;
+	}
+
+	if (quite || !nr_rx)
+		return rc;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	double elapsed = (end.tv_sec - start.tv_sec) +
+			 (end.tv_nsec - start.tv_nsec) / 1e9;
+
+	info("Received %ld messages, %ld-byte in %.3f seconds (%.2f MiB/s)\n",
+	     nr_rx, total_rx_len, elapsed,
+	     elapsed > 0 ? total_rx_len / elapsed / (1024 * 1024) : 0);
+
+	return rc;
+}
+
+/*
+ * Receive a chunked transfer. Each chunk is written to stdout as soon as it
+ * is verified, so the memory footprint is bounded by the chunk size.
+ */
+static int
+run_chunked(int sock)
+{
+	nnio_chunk_rx_t rx;
+
+	nnio_chunk_rx_init(&rx, STDOUT_FILENO);
+
+	int rc = nnio_chunk_rx(sock, &rx);
+	if (rc < 0) {
+		err("Failed to receive the chunked transfer (%ld/%ld-byte)\n",
+		    (long)rx.rx_len, (long)rx.total_len);
+		return rc;
+	}
+
+	if (nnio_util_verbose())
+		info("Total rx length: %ld-byte\n", (long)rx.rx_len);
+
+	return 0;
+}
+
 int
 main(int argc, char **argv)
 {
@@ -68,37 +229,13 @@ main(int argc, char **argv)
 		goto err_add_endpoint;
 	}
 
-	dbg("preparing to receive data from socket ...\n");
-
-	void *data;
-	unsigned int data_len;
-	rc = nnio_socket_rx(sock, &data, &data_len);
-	if (rc < 0) {
-		dbg("Failed to receive data from socket\n");
-		goto err_socket_rx;
-	}
-
-	rc = 0;
-
-	if (!data_len) {
-		if (nnio_util_verbose())
-			info("read socket EOF\n");
-
-		goto err_eof;
-	}
-
-	dbg("reading %d-byte from socket ... \n", data_len);
-
-	fprintf(stdout, "%s", (char *)data);
-	fflush(stdout);
-
-	if (nnio_util_verbose())
-		info("Total rx length: %d-byte\n", data_len);
-
-err_eof:
-	nnio_free_data(data);
+	if (options.chunked)
+		rc = run_chunked(sock);
+	else if (options.stream || options.max_messages)
+		rc = run_continuous(sock, options.max_messages, options.quite);
+	else
+		rc = run_once(sock);
 
-err_socket_rx:
 	nnio_endpoint_delete(sock, ep);
 
 err_add_endpoint:
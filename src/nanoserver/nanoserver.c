@@ -26,11 +26,27 @@ show_usage(const char *prog)
 	info_cont("  --linger-timeout, -l: Set the socket linger timeout\n");
 	info_cont("  --socket-name, -n: Set the socket name\n");
 	info_cont("  --local-endpoint, -L: <url> argument is local\n");
+	info_cont("  --remote-endpoint, -R: <url> argument is remote\n");
+	info_cont("  --protocol, -p: Serve as rep (default) or respondent\n");
 	info_cont("  --exec, -E: Execute an executable\n");
+	info_cont("  --handler, -H: Call <lib.so>[:<symbol>] in process "
+		  "instead\n");
+	info_cont("  --workers, -w: Run the executable in <n> persistent "
+		  "workers\n");
+	info_cont("  --concurrency, -c: Run up to <n> requests "
+		  "concurrently\n");
+	info_cont("  --stream, -s: Stream the output as it arrives\n");
+	info_cont("  --threads, -T: Serve the requests in <n> threads\n");
+	info_cont("  --pin-cpus, -P: Pin each thread to its own CPU\n");
+	info_cont("  --timing, -i: Record the time spent in each phase\n");
+	info_cont("  --metrics, -M: Serve the socket counters on the url\n");
 	info_cont("  --log-file, -g: Specify the log file\n");
 	info_cont("  --daemon, -d: Run as daemon\n");
 	info_cont("\nurl:\n");
 	info_cont("  Specify the transport\n");
+	info_cont("\nsignals:\n");
+	info_cont("  SIGUSR1: Show the percentiles of each phase\n");
+	info_cont("  SIGUSR2: Switch the timing on or off\n");
 }
 
 static void
@@ -44,25 +60,766 @@ exit_notify(void)
 	}
 }
 
+/* Send back the reply of a persistent worker or handler */
 static int
-run_worker(int sock, void *data, unsigned int data_len, const char *exec)
+send_reply(int sock, void *out, unsigned int out_len)
+{
+	int rc;
+
+	if (!out) {
+		/* For nanomsg socket, a nil tx can even unblock the rx side */
+		dbg("preparing to send a nil to socket ...\n");
+
+		rc = nnio_socket_tx(sock, "", 0);
+		if (rc < 0) {
+			err("Failed to send nil data to socket\n");
+			return -1;
+		}
+
+		return 0;
+	}
+
+	dbg("preparing to send %d-byte to socket ...\n", out_len);
+
+	rc = nnio_socket_tx_msg(sock, out, out_len);
+	if (rc < 0) {
+		err("Failed to send %d-byte data to socket\n", out_len);
+		nnio_free_data(out);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Pass the request to a persistent worker and send back its reply */
+static int
+run_pool(int sock, void *data, unsigned int data_len, nnio_pool_t *pool)
+{
+	void *out;
+	unsigned int out_len;
+
+	uint64_t start = nnio_timing_start();
+	int rc = nnio_pool_exec(pool, data, data_len, &out, &out_len);
+	nnio_timing_end(NNIO_PHASE_POOL, start);
+	nnio_free_data(data);
+	if (rc < 0)
+		err("Failed to run the request in worker\n");
+
+	return send_reply(sock, out, out_len);
+}
+
+/* Call the handler on this thread and send back its reply */
+static int
+run_handler(int sock, void *data, unsigned int data_len,
+	    nnio_handler_t *handler)
+{
+	void *out;
+	unsigned int out_len;
+
+	uint64_t start = nnio_timing_start();
+	int rc = nnio_handler_call(handler, data, data_len, &out, &out_len);
+	nnio_timing_end(NNIO_PHASE_HANDLER, start);
+	nnio_free_data(data);
+	if (rc < 0)
+		err("Failed to run the request in handler\n");
+
+	return send_reply(sock, out, out_len);
+}
+
+static int
+run_worker(int sock, void *data, unsigned int data_len, const char *exec,
+	   nnio_pool_t *pool, nnio_handler_t *handler)
 {
 	int rc = 0;
 
+	if (handler)
+		return run_handler(sock, data, data_len, handler);
+
+	if (pool)
+		return run_pool(sock, data, data_len, pool);
+
+	/* A failed task is still replied, so keep serving the others */
 	if (exec)
-		rc = nnio_spawn(sock, exec, data, data_len);
+		nnio_spawn(sock, exec, data, data_len);
 	else {
-		/* Do an echo service */
+		/* Do an echo service by handing the received message back to
+		 * nanomsg without copying it.
+		 */
 		dbg("preparing to send %d-byte to socket ...\n", data_len);
-		int len = nnio_socket_tx(sock, data, data_len);
-		if (len < 0) {
-			err("Failed to send %d-byte data to socket\n", data_len);
-			rc = -1;
+		int len = nnio_socket_tx_msg(sock, data, data_len);
+		if (len >= 0)
+			return 0;
+
+		err("Failed to send %d-byte data to socket\n", data_len);
+		rc = -1;
+	}
+
+	nnio_free_data(data);
+
+	return rc;
+}
+
+/*
+ * Respond a survey. The reply starts with the name of respondent terminated
+ * by a NUL, so the surveyor is able to tell the replies from each host.
+ */
+static int
+run_respondent(int sock, void *data, unsigned int data_len, const char *exec,
+	       nnio_handler_t *handler, const char *name)
+{
+	unsigned int name_len = strlen(name) + 1;
+	nnio_buf_t out = {
+		.data = nnio_alloc_data(name_len),
+		.len = name_len,
+		.size = name_len,
+	};
+	nnio_error_assert(out.data, "Failed to allocate reply");
+
+	memcpy(out.data, name, name_len);
+
+	if (handler) {
+		void *reply;
+		unsigned int reply_len;
+
+		uint64_t start = nnio_timing_start();
+		nnio_handler_call(handler, data, data_len, &reply, &reply_len);
+		nnio_timing_end(NNIO_PHASE_HANDLER, start);
+		if (reply) {
+			out.size += reply_len;
+			out.data = nnio_realloc_data(out.data, out.size);
+			nnio_error_assert(out.data, "Failed to allocate reply");
+
+			memcpy(out.data + out.len, reply, reply_len);
+			out.len = out.size;
+
+			nnio_free_data(reply);
 		}
+	} else if (exec)
+		nnio_spawn_collect(exec, data, data_len, &out);
+	else {
+		out.size += data_len;
+		out.data = nnio_realloc_data(out.data, out.size);
+		nnio_error_assert(out.data, "Failed to allocate reply");
+
+		memcpy(out.data + out.len, data, data_len);
+		out.len = out.size;
 	}
 
 	nnio_free_data(data);
 
+	unsigned int out_len;
+	void *msg = nnio_buf_detach(&out, &out_len);
+
+	dbg("preparing to send %d-byte to socket ...\n", out_len);
+
+	if (nnio_socket_tx_msg(sock, msg, out_len) < 0) {
+		err("Failed to send %d-byte data to socket\n", out_len);
+		nnio_free_data(msg);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Concurrent mode
+ *
+ * The socket is opened as a raw NN_REP so the next request can be received
+ * before replying the previous one. Each request is run in its own child
+ * process, and the reply is sent with the header of the request once the
+ * child exits, regardless of the order of requests.
+ */
+
+typedef struct request request_t;
+
+typedef struct {
+	int sock;
+	const char *exec;
+	bool stream;
+	unsigned int max_running;
+	unsigned int nr_running;
+	bool closing;		/* The end of requests received */
+	nnio_loop_t *loop;
+	nnio_loop_source_t *sock_src;
+	request_t *requests;
+} server_t;
+
+struct request {
+	server_t *server;
+	void *header;
+	pid_t pid;
+	uint64_t spawned;
+	void *in;
+	unsigned int in_len;
+	unsigned int in_off;
+	int in_fd;
+	nnio_loop_source_t *in_src;
+	int out_fd;
+	nnio_loop_source_t *out_src;
+	nnio_buf_t out;
+	bool exited;
+	request_t *next;
+};
+
+static void
+close_source(nnio_loop_source_t **src, int fd)
+{
+	if (!*src)
+		return;
+
+	nnio_loop_remove(*src);
+	close(fd);
+	*src = NULL;
+}
+
+static void
+finish_request(request_t *req)
+{
+	server_t *server = req->server;
+	request_t **pp = &server->requests;
+
+	/* The child exited without consuming all input */
+	close_source(&req->in_src, req->in_fd);
+
+	while (*pp != req)
+		pp = &(*pp)->next;
+	*pp = req->next;
+
+	unsigned int out_len;
+	void *out = nnio_buf_detach(&req->out, &out_len);
+
+	dbg("preparing to send %d-byte to socket for child %d ...\n",
+	    out_len, req->pid);
+
+	int rc = nnio_socket_tx_raw(server->sock, out, out_len, req->header);
+	if (rc < 0) {
+		err("Failed to send %d-byte data to socket\n", out_len);
+
+		if (out)
+			nnio_free_data(out);
+		nnio_free_data(req->header);
+	}
+
+	if (req->in)
+		nnio_free_data(req->in);
+	free(req);
+
+	bool full = server->nr_running-- == server->max_running;
+
+	/* Exit once the requests received before the end are replied */
+	if (server->closing) {
+		if (!server->requests)
+			nnio_loop_stop(server->loop, 0);
+	} else if (full) {
+		/* Accept the requests again */
+		nnio_loop_set_events(server->sock_src, NNIO_LOOP_IN);
+	}
+}
+
+static void
+try_finish_request(request_t *req)
+{
+	/* Wait for both the exit of child and the EOF of its output */
+	if (req->exited && !req->out_src)
+		finish_request(req);
+}
+
+/* Forward the output collected so far as a message of the reply stream */
+static void
+flush_output(request_t *req)
+{
+	unsigned int out_len;
+	void *out = nnio_buf_detach(&req->out, &out_len);
+	if (!out)
+		return;
+
+	dbg("preparing to send %d-byte chunk to socket for child %d ...\n",
+	    out_len, req->pid);
+
+	int rc = nnio_socket_tx_raw_stream(req->server->sock, out, out_len,
+					   req->header);
+	if (rc < 0) {
+		err("Failed to send %d-byte chunk to socket\n", out_len);
+		nnio_free_data(out);
+	}
+}
+
+static int
+feed_child(nnio_loop_t *loop, nnio_loop_source_t *src, int fd,
+	   unsigned int events, void *priv)
+{
+	request_t *req = priv;
+	void *in = req->in + req->in_off;
+	unsigned int in_len = req->in_len - req->in_off;
+
+	int more = nnio_spawn_feed(fd, &in, &in_len);
+
+	req->in_off = req->in_len - in_len;
+	if (more)
+		return 0;
+
+	close_source(&req->in_src, req->in_fd);
+
+	return 0;
+}
+
+static int
+drain_child(nnio_loop_t *loop, nnio_loop_source_t *src, int fd,
+	    unsigned int events, void *priv)
+{
+	request_t *req = priv;
+
+	/* The read is bounded so other requests aren't starved by a child
+	 * writing without pause. The rest is read on the next wakeup.
+	 */
+	int more = nnio_buf_read(&req->out, fd);
+
+	if (req->server->stream)
+		flush_output(req);
+
+	if (more > 0)
+		return 0;
+
+	/* A failed read only ends this request with the output read so far */
+	if (more < 0)
+		err("Failed to read the output of child %d\n", req->pid);
+	else
+		dbg("output pipe EOF for child %d\n", req->pid);
+
+	close_source(&req->out_src, req->out_fd);
+
+	try_finish_request(req);
+
+	return 0;
+}
+
+static int
+reap_children(nnio_loop_t *loop, nnio_loop_source_t *src, int signo,
+	      unsigned int events, void *priv)
+{
+	server_t *server = priv;
+
+	while (1) {
+		int status;
+		pid_t pid = waitpid(-1, &status, WNOHANG);
+		if (pid <= 0)
+			break;
+
+		dbg("child %d exited\n", pid);
+
+		for (request_t *req = server->requests; req; req = req->next) {
+			if (req->pid == pid) {
+				nnio_spawn_exited(pid, status, req->spawned);
+				req->exited = true;
+				try_finish_request(req);
+				break;
+			}
+		}
+	}
+
+	return 0;
+}
+
+static int
+accept_request(nnio_loop_t *loop, nnio_loop_source_t *src, int sock,
+	       unsigned int events, void *priv)
+{
+	server_t *server = priv;
+	void *data, *header;
+	unsigned int data_len;
+
+	int rc = nnio_socket_rx_raw(sock, &data, &data_len, &header,
+				    NN_DONTWAIT);
+	if (rc < 0)
+		return errno == EAGAIN ? 0 : -1;
+
+	if (!data_len) {
+		if (nnio_util_verbose())
+			info("read socket EOF\n");
+
+		nnio_free_data(data);
+		nnio_free_data(header);
+
+		/* Stop accepting, but let the running children finish */
+		server->closing = true;
+		nnio_loop_set_events(src, 0);
+		if (!server->requests)
+			nnio_loop_stop(loop, 0);
+
+		return 0;
+	}
+
+	dbg("reading %d-byte from socket ...\n", data_len);
+
+	if (!server->exec) {
+		/* Do an echo service */
+		if (server->stream) {
+			rc = nnio_socket_tx_raw_stream(sock, data, data_len,
+						       header);
+			if (rc < 0)
+				nnio_free_data(data);
+
+			/* Followed by the end of stream */
+			data = NULL;
+			data_len = 0;
+		}
+
+		rc = nnio_socket_tx_raw(sock, data, data_len, header);
+		if (rc < 0) {
+			err("Failed to send %d-byte data to socket\n",
+			    data_len);
+			if (data)
+				nnio_free_data(data);
+			nnio_free_data(header);
+		}
+
+		return 0;
+	}
+
+	int in_fd, out_fd;
+	uint64_t spawned = nnio_spawn_started();
+	pid_t pid = nnio_spawn_async(server->exec, &in_fd, &out_fd);
+	if (pid < 0) {
+		nnio_free_data(data);
+
+		/* Reply an empty output */
+		rc = nnio_socket_tx_raw(sock, NULL, 0, header);
+		if (rc < 0) {
+			err("Failed to send nil data to socket\n");
+			nnio_free_data(header);
+		}
+
+		return 0;
+	}
+
+	request_t *req = calloc(1, sizeof(*req));
+	nnio_error_assert(req, "Failed to allocate request");
+
+	req->server = server;
+	req->header = header;
+	req->in = data;
+	req->in_len = data_len;
+	req->pid = pid;
+	req->spawned = spawned;
+	req->in_fd = in_fd;
+	req->out_fd = out_fd;
+	req->in_src = nnio_loop_add_fd(loop, req->in_fd, NNIO_LOOP_OUT,
+				       feed_child, req);
+	req->out_src = nnio_loop_add_fd(loop, req->out_fd, NNIO_LOOP_IN,
+					drain_child, req);
+
+	req->next = server->requests;
+	server->requests = req;
+
+	/* Hold the further requests in socket until a child exits */
+	if (++server->nr_running == server->max_running)
+		nnio_loop_set_events(src, 0);
+
+	return 0;
+}
+
+static int
+run_concurrent(int sock, nnio_options_t *options)
+{
+	server_t server = {
+		.sock = sock,
+		.exec = options->exec,
+		.stream = options->stream,
+		.max_running = options->concurrency,
+	};
+
+	nnio_error_assert(signal(SIGPIPE, SIG_IGN) != SIG_ERR,
+			  "Unable to capture SIGPIPE");
+
+	nnio_loop_t *loop = nnio_loop_create();
+	server.loop = loop;
+
+	nnio_loop_add_signal(loop, SIGCHLD, reap_children, &server);
+	server.sock_src = nnio_loop_add_socket(loop, sock, NNIO_LOOP_IN,
+					       accept_request, &server);
+
+	int rc = nnio_loop_run(loop);
+
+	nnio_loop_destroy(loop);
+
+	return rc < 0 ? rc : 0;
+}
+
+/*
+ * Stream mode
+ *
+ * Each request is run serially but its output is streamed back as it
+ * arrives, followed by an empty message as the end of stream. Multiple
+ * replies to a request are only possible with a raw NN_REP socket.
+ */
+static int
+run_stream(int sock, nnio_options_t *options)
+{
+	while (1) {
+		dbg("preparing to receive data from socket ...\n");
+
+		void *data, *header;
+		unsigned int data_len;
+		int rc = nnio_socket_rx_raw(sock, &data, &data_len, &header, 0);
+		if (rc < 0) {
+			dbg("Failed to receive data from socket\n");
+			return rc;
+		}
+
+		if (!data_len) {
+			if (nnio_util_verbose())
+				info("read socket EOF\n");
+
+			nnio_free_data(data);
+			nnio_free_data(header);
+
+			return 0;
+		}
+
+		dbg("reading %d-byte from socket ...\n", data_len);
+
+		if (options->exec)
+			rc = nnio_spawn_stream(sock, options->exec, data,
+					       data_len, header);
+		else {
+			/* Do an echo service */
+			rc = nnio_socket_tx_raw_stream(sock, data, data_len,
+						       header);
+			if (rc >= 0) {
+				data = NULL;
+				rc = nnio_socket_tx_raw_stream(sock, NULL, 0,
+							       header);
+			}
+		}
+
+		if (data)
+			nnio_free_data(data);
+		nnio_free_data(header);
+
+		if (rc < 0) {
+			dbg("preparing to exit due to failure ...\n");
+			return rc;
+		}
+	}
+}
+
+/*
+ * Threaded mode
+ *
+ * The raw front socket is bridged to a raw NN_REQ back end on inproc, which
+ * load-balances the requests over the worker threads. Each worker thread
+ * has its own NN_REP socket connected to the back end, so the threads
+ * never contend on a socket and the replies are routed back through the
+ * bridge with their headers.
+ */
+
+#define NANOSERVER_BACK_URL		"inproc://nanoserver"
+
+/* How often the threads check for exiting, in millisecond */
+#define NANOSERVER_POLL_INTERVAL	200
+
+typedef struct {
+	int sock;
+	const char *exec;
+	nnio_handler_t *handler;
+	int cpu;
+	pthread_t thread;
+	unsigned long nr_requests;
+} server_thread_t;
+
+static bool exiting;
+
+static void *
+forward(void *arg)
+{
+	nnio_forward(arg);
+
+	return NULL;
+}
+
+static void *
+serve_thread(void *arg)
+{
+	server_thread_t *t = arg;
+
+	if (t->cpu >= 0) {
+		cpu_set_t set;
+
+		CPU_ZERO(&set);
+		CPU_SET(t->cpu, &set);
+		if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set))
+			err("Unable to pin thread to CPU %d\n", t->cpu);
+	}
+
+	while (!__atomic_load_n(&exiting, __ATOMIC_RELAXED)) {
+		void *data;
+		unsigned int data_len;
+
+		if (nnio_socket_rx(t->sock, &data, &data_len) < 0)
+			continue;
+
+		if (!data_len) {
+			if (nnio_util_verbose())
+				info("read socket EOF\n");
+
+			nnio_free_data(data);
+
+			/* Stop all threads in the same way as a signal */
+			kill(getpid(), SIGTERM);
+			continue;
+		}
+
+		dbg("reading %d-byte from socket ...\n", data_len);
+
+		uint64_t start = nnio_timing_start();
+		run_worker(t->sock, data, data_len, t->exec, NULL, t->handler);
+		nnio_timing_end(NNIO_PHASE_REQUEST, start);
+
+		++t->nr_requests;
+	}
+
+	return NULL;
+}
+
+/* Return the n-th CPU the process is allowed to run on, or -1 */
+static int
+nth_cpu(cpu_set_t *set, unsigned int n)
+{
+	int nr_cpus = CPU_COUNT(set);
+	if (!nr_cpus)
+		return -1;
+
+	n %= nr_cpus;
+	for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+		if (CPU_ISSET(cpu, set) && !n--)
+			return cpu;
+	}
+
+	return -1;
+}
+
+static int
+run_threads(int sock, nnio_options_t *options, nnio_handler_t *handler)
+{
+	unsigned int nr_threads = options->threads;
+	int rc = -1;
+
+	int back = nnio_socket_open_raw(NN_REQ, NANOSERVER_POLL_INTERVAL,
+					NANOSERVER_POLL_INTERVAL, NULL, -1);
+	if (back < 0)
+		return -1;
+
+	int back_ep = nnio_endpoint_add_local(back, NANOSERVER_BACK_URL);
+	if (back_ep < 0)
+		goto err_back_endpoint;
+
+	server_thread_t *threads = calloc(nr_threads, sizeof(*threads));
+	nnio_error_assert(threads, "Failed to allocate threads");
+
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+	if (options->pin_cpus && sched_getaffinity(0, sizeof(cpus), &cpus))
+		err("Unable to get the CPU affinity\n");
+
+	/* The children of all threads may exit at any time */
+	nnio_error_assert(signal(SIGPIPE, SIG_IGN) != SIG_ERR,
+			  "Unable to capture SIGPIPE");
+
+	/* The signals are handled by the main thread only */
+	sigset_t mask;
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+	unsigned int nr_running;
+	for (nr_running = 0; nr_running < nr_threads; ++nr_running) {
+		server_thread_t *t = threads + nr_running;
+
+		t->sock = nnio_socket_open(NN_REP, options->tx_timeout,
+					   NANOSERVER_POLL_INTERVAL, NULL, -1);
+		if (t->sock < 0)
+			goto err_thread;
+
+		if (nnio_endpoint_add_remote(t->sock, NANOSERVER_BACK_URL) < 0) {
+			nnio_socket_close(t->sock);
+			goto err_thread;
+		}
+
+		t->exec = options->exec;
+		t->handler = handler;
+		t->cpu = options->pin_cpus ? nth_cpu(&cpus, nr_running) : -1;
+
+		if (pthread_create(&t->thread, NULL, serve_thread, t)) {
+			err("Failed to create the server thread\n");
+			nnio_socket_close(t->sock);
+			goto err_thread;
+		}
+	}
+
+	nnio_forward_t fwds[] = {
+		{
+			.rx_sock = sock,
+			.tx_sock = back,
+			.exiting = &exiting,
+		},
+		{
+			.rx_sock = back,
+			.tx_sock = sock,
+			.exiting = &exiting,
+		},
+	};
+	pthread_t fwd_threads[2];
+	unsigned int nr_fwds;
+
+	for (nr_fwds = 0; nr_fwds < 2; ++nr_fwds) {
+		if (pthread_create(fwd_threads + nr_fwds, NULL, forward,
+				   fwds + nr_fwds)) {
+			err("Failed to create the forwarding thread\n");
+			goto err_forward;
+		}
+	}
+
+	int signo;
+	while (sigwait(&mask, &signo))
+		;
+
+	dbg("signal %d received\n", signo);
+
+	rc = 0;
+
+err_forward:
+	__atomic_store_n(&exiting, true, __ATOMIC_RELAXED);
+
+	while (nr_fwds--)
+		pthread_join(fwd_threads[nr_fwds], NULL);
+
+err_thread:
+	__atomic_store_n(&exiting, true, __ATOMIC_RELAXED);
+
+	/* The threads finish the requests in flight. Another signal kills
+	 * the process if it takes too long.
+	 */
+	pthread_sigmask(SIG_UNBLOCK, &mask, NULL);
+
+	unsigned long nr_requests = 0;
+	while (nr_running--) {
+		pthread_join(threads[nr_running].thread, NULL);
+		nnio_socket_close(threads[nr_running].sock);
+		nr_requests += threads[nr_running].nr_requests;
+	}
+
+	if (!options->quite)
+		info("%ld requests served by %d threads\n", nr_requests,
+		     nr_threads);
+
+	free(threads);
+
+	nnio_endpoint_delete(back, back_ep);
+
+err_back_endpoint:
+	nnio_socket_close(back);
+
 	return rc;
 }
 
@@ -119,21 +876,102 @@ main(int argc, char **argv)
 	if (!options.quite)
 		nnio_show_banner(argv[0]);
 
-	int sock = nnio_socket_open(NN_REP, options.tx_timeout,
-				    options.rx_timeout, options.socket_name,
-				    options.linger_timeout);
+	/* Before any thread is created so SIGUSR1/SIGUSR2 are all blocked */
+	nnio_timing_setup(options.timing);
+
+	if (options.metrics && nnio_stats_serve(options.metrics))
+		die("Unable to serve the metrics on %s\n", options.metrics);
+
+	if ((options.concurrency || options.stream) && options.workers)
+		die("--workers can't be used with --concurrency or "
+		    "--stream\n");
+
+	if (options.threads && (options.workers || options.concurrency ||
+				options.stream))
+		die("--threads can't be used with --workers, --concurrency or "
+		    "--stream\n");
+
+	/* The handler runs in process so it takes over from -E */
+	if (options.handler && (options.exec || options.workers ||
+				options.concurrency || options.stream))
+		die("--handler can't be used with --exec, --workers, "
+		    "--concurrency or --stream\n");
+
+	int protocol = options.protocol == -1 ? NN_REP : options.protocol;
+	if (protocol != NN_REP && protocol != NN_RESPONDENT)
+		die("--protocol only accepts rep or respondent\n");
+
+	/* The name of respondent tagging each reply */
+	char name[HOST_NAME_MAX + 1] = "";
+	if (protocol == NN_RESPONDENT) {
+		if (options.concurrency || options.stream || options.workers ||
+		    options.threads)
+			die("respondent can't be used with --workers, "
+			    "--concurrency, --stream or --threads\n");
+
+		if (options.socket_name)
+			snprintf(name, sizeof(name), "%s", options.socket_name);
+		else
+			gethostname(name, sizeof(name) - 1);
+	}
+
+	int sock;
+	if (options.threads)
+		sock = nnio_socket_open_raw(protocol, NANOSERVER_POLL_INTERVAL,
+					    NANOSERVER_POLL_INTERVAL,
+					    options.socket_name,
+					    options.linger_timeout);
+	else if (options.concurrency || options.stream)
+		sock = nnio_socket_open_raw(protocol, options.tx_timeout,
+					    options.rx_timeout,
+					    options.socket_name,
+					    options.linger_timeout);
+	else
+		sock = nnio_socket_open(protocol, options.tx_timeout,
+					options.rx_timeout,
+					options.socket_name,
+					options.linger_timeout);
 	if (sock < 0)
 		return -1;
 
-	nnio_error_assert(options.local_endpoint, "-L option required");
-
 	int rc = 0;
-	int ep = nnio_endpoint_add_local(sock, *options.local_endpoint);
+	int ep;
+	if (options.local_endpoint)
+		ep = nnio_endpoint_add_local(sock, *options.local_endpoint);
+	else
+		ep = nnio_endpoint_add_remote(sock, *options.remote_endpoint);
 	if (ep < 0) {
 		rc = -1;
 		goto err_add_endpoint;
 	}
 
+	/* Parse the command line once for all requests */
+	if (options.exec)
+		nnio_spawn_prepare(options.exec);
+
+	nnio_pool_t *pool = NULL;
+	if (options.exec && options.workers)
+		pool = nnio_pool_create(options.exec, options.workers);
+
+	nnio_handler_t *handler = NULL;
+	if (options.handler)
+		handler = nnio_handler_load(options.handler);
+
+	if (options.concurrency) {
+		rc = run_concurrent(sock, &options);
+		goto err_socket_rx;
+	}
+
+	if (options.stream) {
+		rc = run_stream(sock, &options);
+		goto err_socket_rx;
+	}
+
+	if (options.threads) {
+		rc = run_threads(sock, &options, handler);
+		goto err_socket_rx;
+	}
+
 	while (1) {
 		dbg("preparing to receive data from socket ...\n");
 
@@ -151,28 +989,45 @@ main(int argc, char **argv)
 			if (nnio_util_verbose())
 				info("read socket EOF\n");
 
-			goto err_eof;
+			nnio_free_data(data);
+			break;
 		}
 
 		dbg("reading %d-byte from socket ...\n", data_len);
 
-		rc = run_worker(sock, data, data_len, options.exec);
+		uint64_t start = nnio_timing_start();
+
+		/* The data is consumed in any case */
+		if (protocol == NN_RESPONDENT)
+			rc = run_respondent(sock, data, data_len, options.exec,
+					    handler, name);
+		else
+			rc = run_worker(sock, data, data_len, options.exec,
+					pool, handler);
+
+		nnio_timing_end(NNIO_PHASE_REQUEST, start);
+
 		if (rc) {
-err_eof:
 			dbg("preparing to exit due to failure ...\n");
-			nnio_free_data(data);
 			break;
 		}
 	}
 
 err_socket_rx:
+	if (pool)
+		nnio_pool_destroy(pool);
+
+	if (handler)
+		nnio_handler_unload(handler);
+
+	nnio_timing_show();
+
 	/* If the tx socket is closed before the sent data received, the rx
 	 * socket would be blocked forever. Essentially speaking, this is
 	 * caused by the lack of the support for the linger timeout in
 	 * nanomsg.
 	 */
-	if (options.exit_delay)
-		usleep(options.exit_delay);
+	nnio_socket_drain(sock, options.drain_timeout);
 
 	dbg("closing socket ...\n");
 
@@ -0,0 +1,220 @@
+/*
+ * nnio pipeline worker
+ *
+ * Copyright (c) 2016, Wind River Systems, Inc.
+ * All rights reserved.
+ *
+ * See "LICENSE" for license terms.
+ *
+ * Author:
+ *	  Lans Zhang <jia.zhang@windriver.com>
+ */
+
+#include <nnio.h>
+
+/*
+ * A stage of pipeline. The tasks are pulled from the upstream, run through
+ * the executable or echoed, and the results are pushed to the downstream.
+ * The worker threads share the same pair of sockets, so nanomsg hands each
+ * task to whichever thread is idle.
+ */
+
+/* How often the worker threads check for exiting, in millisecond */
+#define NANOWORKER_POLL_INTERVAL	200
+
+typedef struct {
+	int rx_sock;
+	int tx_sock;
+	const char *exec;
+	pthread_t thread;
+	unsigned long nr_tasks;
+} worker_t;
+
+static bool exiting;
+
+static void
+show_usage(const char *prog)
+{
+	info_cont("usage: %s <options> <url>\n", prog);
+	info_cont("\noptions:\n");
+	info_cont("  --help, -h: Print this help information\n");
+	info_cont("  --version, -V: Show version number\n");
+	info_cont("  --verbose, -v: Show verbose messages\n");
+	info_cont("  --quite, -q: Don't show banner information\n");
+	info_cont("  --tx-timeout, -t: Set the socket tx timeout\n");
+	info_cont("  --socket-name, -n: Set the socket name\n");
+	info_cont("  --local-endpoint, -L: <url> argument is local\n");
+	info_cont("  --remote-endpoint, -R: <url> argument is remote\n");
+	info_cont("  --back-end, -b: Set the downstream url to connect\n");
+	info_cont("  --exec, -E: Run each task through the executable\n");
+	info_cont("  --workers, -w: Set the number of worker threads\n");
+	info_cont("\nurl:\n");
+	info_cont("  Specify the upstream transport\n");
+}
+
+static void *
+run_worker(void *arg)
+{
+	worker_t *worker = arg;
+
+	while (!__atomic_load_n(&exiting, __ATOMIC_RELAXED)) {
+		void *data;
+		unsigned int data_len;
+
+		if (nnio_socket_rx(worker->rx_sock, &data, &data_len) < 0)
+			continue;
+
+		dbg("reading %d-byte task from socket ...\n", data_len);
+
+		int rc;
+
+		if (worker->exec) {
+			rc = nnio_spawn(worker->tx_sock, worker->exec, data,
+					data_len);
+			nnio_free_data(data);
+		} else {
+			rc = nnio_socket_tx_msg(worker->tx_sock, data,
+						data_len);
+			if (rc < 0) {
+				err("Failed to send %d-byte data to socket\n",
+				    data_len);
+				nnio_free_data(data);
+			}
+		}
+
+		/* Only the tasks delivered downstream are done */
+		if (rc >= 0)
+			++worker->nr_tasks;
+	}
+
+	return NULL;
+}
+
+static void
+exit_notify(void)
+{
+	if (nnio_util_verbose()) {
+		int err = nn_errno();
+
+		info("nanoworker exiting with %d (%s)\n", err,
+		     nn_strerror(err));
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	atexit(exit_notify);
+
+	nnio_options_t options = {
+		.show_usage = show_usage,
+	};
+
+	nnio_options_parse(argc, argv, &options);
+
+	if (!options.quite)
+		nnio_show_banner(argv[0]);
+
+	nnio_error_assert(options.back_url, "-b option required");
+
+	unsigned int nr_workers = options.workers ? options.workers : 1;
+
+	int rx_sock = nnio_socket_open(NN_PULL, -1, NANOWORKER_POLL_INTERVAL,
+				       options.socket_name, -1);
+	if (rx_sock < 0)
+		return -1;
+
+	int rc = -1;
+	int rx_ep;
+	if (options.local_endpoint)
+		rx_ep = nnio_endpoint_add_local(rx_sock,
+						*options.local_endpoint);
+	else
+		rx_ep = nnio_endpoint_add_remote(rx_sock,
+						 *options.remote_endpoint);
+	if (rx_ep < 0)
+		goto err_rx_endpoint;
+
+	int tx_sock = nnio_socket_open(NN_PUSH, options.tx_timeout, -1,
+				       options.socket_name,
+				       options.linger_timeout);
+	if (tx_sock < 0)
+		goto err_tx_socket;
+
+	int tx_ep = nnio_endpoint_add_remote(tx_sock, options.back_url);
+	if (tx_ep < 0)
+		goto err_tx_endpoint;
+
+	/* Parse the command line once for all tasks. This also ignores
+	 * SIGPIPE as the children of all workers may exit at any time.
+	 */
+	if (options.exec)
+		nnio_spawn_prepare(options.exec);
+
+	worker_t *workers = calloc(nr_workers, sizeof(*workers));
+	nnio_error_assert(workers, "Failed to allocate workers");
+
+	/* The signals are handled by the main thread only */
+	sigset_t mask;
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+	unsigned int nr_threads;
+	for (nr_threads = 0; nr_threads < nr_workers; ++nr_threads) {
+		worker_t *worker = workers + nr_threads;
+
+		worker->rx_sock = rx_sock;
+		worker->tx_sock = tx_sock;
+		worker->exec = options.exec;
+
+		if (pthread_create(&worker->thread, NULL, run_worker, worker)) {
+			err("Failed to create the worker thread\n");
+			goto err_thread;
+		}
+	}
+
+	int signo;
+	while (sigwait(&mask, &signo))
+		;
+
+	dbg("signal %d received\n", signo);
+
+	rc = 0;
+
+err_thread:
+	__atomic_store_n(&exiting, true, __ATOMIC_RELAXED);
+
+	/* The workers finish the tasks in flight. Another signal kills the
+	 * process if it takes too long.
+	 */
+	pthread_sigmask(SIG_UNBLOCK, &mask, NULL);
+
+	unsigned long nr_tasks = 0;
+	while (nr_threads--) {
+		pthread_join(workers[nr_threads].thread, NULL);
+		nr_tasks += workers[nr_threads].nr_tasks;
+	}
+
+	if (!options.quite)
+		info("%ld tasks done by %d workers\n", nr_tasks, nr_workers);
+
+	free(workers);
+
+	/* Give the results still queued a chance to reach the back end */
+	nnio_socket_drain(tx_sock, options.drain_timeout);
+
+	nnio_endpoint_delete(tx_sock, tx_ep);
+
+err_tx_endpoint:
+	nnio_socket_close(tx_sock);
+
+err_tx_socket:
+	nnio_endpoint_delete(rx_sock, rx_ep);
+
+err_rx_endpoint:
+	nnio_socket_close(rx_sock);
+
+	return rc;
+}
@@ -25,7 +25,12 @@ show_usage(const char *prog)
 	info_cont("  --linger-timeout, -l: Set the socket linger timeout\n");
 	info_cont("  --socket-name, -n: Set the socket name\n");
 	info_cont("  --remote-endpoint, -R: <url> argument is remote\n");
-	info_cont("  --exit-delay, -e: Delay to exit\n");
+	info_cont("  --drain-timeout, -e: Set the timeout to drain the sent data\n");
+	info_cont("  --stream, -s: Send stdin as a stream of chunks until EOF\n");
+	info_cont("  --chunk-size, -k: Set the chunk size for -s or -C\n");
+	info_cont("  --chunked, -C: Send the stdin file as a chunked transfer\n");
+	info_cont("  --file, -f: Send the file instead of stdin\n");
+	info_cont("  --agent, -a: Call through the nanoagent listening on the path\n");
 	info_cont("\nurl:\n");
 	info_cont("  Specify the transport\n");
 }
@@ -41,6 +46,202 @@ exit_notify(void)
 	}
 }
 
+/* The default chunk size in stream mode */
+#define NANOWRITE_CHUNK_SIZE		(64 * 1024)
+
+static int
+send_eos(int sock)
+{
+	dbg("preparing to send the end of stream to socket ...\n");
+
+	if (nnio_socket_tx(sock, "", 0) < 0) {
+		err("Failed to send the end of stream to socket\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Return whatever is available up to len, or 0 on EOF */
+static ssize_t
+read_chunk(void *buf, size_t len)
+{
+	while (1) {
+		ssize_t sz = read(STDIN_FILENO, buf, len);
+		if (sz >= 0 || errno != EINTR)
+			return sz;
+	}
+}
+
+/*
+ * Send stdin as a stream of chunks followed by an empty message marking the
+ * end of stream. Each read is sent as soon as it returns rather than after
+ * filling the whole chunk, so a slow producer such as "tail -f" is not held
+ * back. Each chunk is handed over to nanomsg without copying, so
+ * nanomsg puts it on the wire while the next chunk is being read. The
+ * memory footprint is bounded by the chunk size and NN_SNDBUF because the
+ * send blocks once the socket is full.
+ */
+static int
+run_stream(int sock, unsigned int chunk_size)
+{
+	unsigned long total_len = 0;
+
+	while (1) {
+		void *chunk = nnio_alloc_data(chunk_size);
+		nnio_error_assert(chunk, "Failed to allocate memory");
+
+		ssize_t len = read_chunk(chunk, chunk_size);
+		if (len <= 0) {
+			nnio_free_data(chunk);
+
+			if (len < 0) {
+				err("Failed to read data from stdin\n");
+				return -1;
+			}
+
+			break;
+		}
+
+		dbg("reading %ld-byte from stdin ...\n", len);
+
+		/* nanomsg always sends the whole buffer */
+		if (len != chunk_size) {
+			chunk = nnio_realloc_data(chunk, len);
+			nnio_error_assert(chunk, "Failed to trim memory");
+		}
+
+		if (nnio_socket_tx_msg(sock, chunk, len) < 0) {
+			err("Failed to send %ld-byte chunk to socket\n", len);
+			nnio_free_data(chunk);
+			return -1;
+		}
+
+		total_len += len;
+	}
+
+	if (nnio_util_verbose())
+		info("read stdin EOF\n");
+
+	if (send_eos(sock) < 0)
+		return -1;
+
+	if (nnio_util_verbose())
+		info("Total tx length: %ld-byte\n", total_len);
+
+	return 0;
+}
+
+/*
+ * Send the file from its mapping. nanomsg copies each message from the page
+ * cache directly, so the file never goes through a user buffer.
+ */
+static int
+run_file(int sock, nnio_options_t *options)
+{
+	unsigned long len;
+	void *addr = nnio_file_map(options->file, &len);
+	if (!addr)
+		return -1;
+
+	unsigned int chunk_size = options->chunk_size ?
+				  options->chunk_size : NANOWRITE_CHUNK_SIZE;
+	int rc = 0;
+
+	if (options->chunked)
+		rc = nnio_chunk_tx_data(sock, addr, len, options->chunk_size);
+	else if (options->stream) {
+		unsigned long off = 0;
+
+		while (off < len) {
+			unsigned int sz = len - off < chunk_size ?
+					  len - off : chunk_size;
+
+			dbg("preparing to send %d-byte chunk to socket ...\n",
+			    sz);
+
+			if (nnio_socket_tx(sock, addr + off, sz) < 0) {
+				err("Failed to send %d-byte chunk to socket\n",
+				    sz);
+				rc = -1;
+				break;
+			}
+
+			off += sz;
+		}
+
+		if (!rc)
+			rc = send_eos(sock);
+	} else if (len) {
+		int max_len;
+		size_t sz = sizeof(max_len);
+
+		/* A receiver drops a message beyond its NN_RCVMAXSIZE, which
+		 * is assumed to be the same as ours. -1 means no limit.
+		 */
+		rc = nn_getsockopt(sock, NN_SOL_SOCKET, NN_RCVMAXSIZE,
+				   &max_len, &sz);
+		nnio_error_assert(!rc, "Failed to get NN_RCVMAXSIZE");
+
+		unsigned long max = max_len < 0 ? UINT_MAX : max_len;
+
+		if (len > max) {
+			err("File %s exceeds %ld-byte for a single message, "
+			    "use -s or -C instead\n", options->file, max);
+			rc = -1;
+		} else {
+			dbg("preparing to send %ld-byte to socket ...\n",
+			    len);
+
+			if (nnio_socket_tx(sock, addr, len) < 0) {
+				err("Failed to send data to socket\n");
+				rc = -1;
+			}
+		}
+	}
+
+	nnio_file_unmap(addr, len);
+
+	if (!rc && nnio_util_verbose())
+		info("Total tx length: %ld-byte\n", len);
+
+	return rc;
+}
+
+/*
+ * Send stdin as a chunked transfer. The length must be known in advance
+ * for the receiver to preallocate the reassembly buffer, so stdin has to
+ * be redirected from a regular file.
+ */
+static int
+run_chunked(int sock, unsigned int chunk_size)
+{
+	struct stat st;
+
+	if (fstat(STDIN_FILENO, &st) < 0 || !S_ISREG(st.st_mode)) {
+		err("Chunked mode requires stdin to be a regular file\n");
+		return -1;
+	}
+
+	off_t offset = lseek(STDIN_FILENO, 0, SEEK_CUR);
+	if (offset < 0)
+		offset = 0;
+
+	uint64_t len = st.st_size - offset;
+
+	dbg("preparing to send %ld-byte in %d-byte chunks ...\n", (long)len,
+	    chunk_size);
+
+	int rc = nnio_chunk_tx_fd(sock, STDIN_FILENO, len, chunk_size);
+	if (rc < 0)
+		return rc;
+
+	if (nnio_util_verbose())
+		info("Total tx length: %ld-byte\n", (long)len);
+
+	return 0;
+}
+
 int
 main(int argc, char **argv)
 {
@@ -55,6 +256,18 @@ main(int argc, char **argv)
 	if (!options.quite)
 		nnio_show_banner(argv[0]);
 
+	if (options.agent) {
+		if (options.stream || options.chunked)
+			die("--agent can't be used with --stream or --chunked\n");
+
+		nnio_error_assert(options.remote_endpoint, "-R option required");
+
+		/* The agent reads the payload and writes the reply */
+		return nnio_agent_call_file(options.agent, NN_PUSH,
+					    *options.remote_endpoint,
+					    options.file);
+	}
+
 	int sock = nnio_socket_open(NN_PUSH, options.tx_timeout,
 				    -1, options.socket_name,
 				    options.linger_timeout);
@@ -70,12 +283,33 @@ main(int argc, char **argv)
 		goto err_add_endpoint;
 	}
 
+	void *data = NULL;
+
+	if (options.file) {
+		rc = run_file(sock, &options);
+		goto err_read;
+	}
+
+	if (options.chunked) {
+		rc = run_chunked(sock, options.chunk_size);
+		goto err_read;
+	}
+
+	if (options.stream) {
+		unsigned int chunk_size = options.chunk_size ?
+					  options.chunk_size :
+					  NANOWRITE_CHUNK_SIZE;
+
+		rc = run_stream(sock, chunk_size);
+		goto err_read;
+	}
+
 	unsigned int data_len;
 	size_t sz = sizeof(data_len);
 	rc = nn_getsockopt(sock, NN_SOL_SOCKET, NN_RCVMAXSIZE, &data_len, &sz);
 	nnio_error_assert(!rc, "Failed to get NN_RCVMAXSIZE");
 
-	void *data = malloc(data_len);
+	data = nnio_alloc_data(data_len);
 	nnio_error_assert(data, "Failed to allocate memory");
 
 	ssize_t len = read(STDIN_FILENO, data, data_len);
@@ -94,28 +328,37 @@ main(int argc, char **argv)
 		goto err_read;
 	}
 
+	/* nanomsg sends the whole buffer on zero-copy */
+	if (len != data_len) {
+		data = nnio_realloc_data(data, len);
+		nnio_error_assert(data, "Failed to trim memory");
+	}
+
 	dbg("preparing to send %d-byte to socket ...\n", (int)len);
 
-	len = nnio_socket_tx(sock, data, len);
+	len = nnio_socket_tx_msg(sock, data, len);
 	if (len < 0) {
-		err("Failed to send %ld-byte data to socket\n", len);
+		err("Failed to send data to socket\n");
 		rc = -1;
 		goto err_read;
 	}
 
+	/* The ownership of data is passed to nanomsg */
+	data = NULL;
+
 	if (nnio_util_verbose())
 		info("Total tx length: %ld-byte\n", len);
 
 err_read:
-	free(data);
+	if (data)
+		nnio_free_data(data);
 
 	/* If the tx socket is closed before the sent data received, the rx
 	 * socket would be blocked forever. Essentially speaking, this is
 	 * caused by the lack of the support for the linger timeout in
 	 * nanomsg.
 	 */
-	if (options.exit_delay)
-		usleep(options.exit_delay);
+	nnio_socket_drain(sock, options.drain_timeout);
 
 	dbg("closing socket ...\n");
 